@@ -0,0 +1,210 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Downsampling benchmark.
+//	Times I_FinishUpdate on a random 320x200 frame at scaling
+//	 2, 4 and 8, without -boxfilter, where the cells are built
+//	 from the palette indices, and with it, where each block
+//	 is averaged into DG_ScreenBuffer with each kernel and the
+//	 cells are built from that. Both include encoding the
+//	 cells, which are written to /dev/null.
+//
+//	boxfilter [-frames <n>] [-chars <>] [-colors <>]
+//
+//	Prints the best of five runs, in us per frame.
+//
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i_system.h"
+
+// for its statics
+#include "i_video.c"
+
+
+#define RUNS	5
+
+typedef struct
+{
+    char*	name;
+    void	(*accumulate)(const byte *in);
+    void	(*reduce)(uint32_t *out, int out_pixels);
+    int		simd;	// 0 none, 1 sse2, 2 avx2
+} boxkernel_t;
+
+static boxkernel_t kernels[] =
+{
+    { "scalar", box_accumulate_scalar, box_reduce_scalar, 0 },
+#ifdef BOX_SIMD
+    { "sse2", box_accumulate_sse2, box_reduce_sse2, 1 },
+    { "avx2", box_accumulate_avx2, box_reduce_sse2, 2 },
+#endif
+};
+
+#define NUMKERNELS	(int) (sizeof(kernels) / sizeof(*kernels))
+
+static uint32_t reference[SCREENWIDTH * SCREENHEIGHT];
+
+
+// I_Error waits forever once it is done, so leave before that
+static void Quit (void)
+{
+    exit (1);
+}
+
+
+static uint64_t NowNS (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static double TimeFrames (int frames)
+{
+    uint64_t	start;
+    uint64_t	best;
+    uint64_t	time;
+    int		run;
+    int		i;
+
+    best = UINT64_MAX;
+
+    for (run = 0; run < RUNS; run++)
+    {
+	start = NowNS ();
+
+	for (i = 0; i < frames; i++)
+	    I_FinishUpdate ();
+
+	time = NowNS () - start;
+
+	if (time < best)
+	    best = time;
+    }
+
+    return best / 1000.0 / frames;
+}
+
+
+static bool Supported (boxkernel_t *kernel)
+{
+#ifdef BOX_SIMD
+    __builtin_cpu_init ();
+
+    if (kernel->simd == 1)
+	return __builtin_cpu_supports ("sse2");
+    if (kernel->simd == 2)
+	return __builtin_cpu_supports ("avx2");
+#endif
+    return true;
+}
+
+
+//
+// SetScaling
+// Set up the terminal output for the given
+//  scaling, as dg_Create and I_InitGraphics do.
+//
+static void SetScaling (int scaling, byte *palette)
+{
+    fb_scaling = scaling;
+    DOOMGENERIC_RESX = s_Fb.xres = SCREENWIDTH / scaling;
+    DOOMGENERIC_RESY = s_Fb.yres = SCREENHEIGHT / scaling;
+
+    free (DG_ScreenBuffer);
+    DG_ScreenBuffer = malloc (DOOMGENERIC_RESX * DOOMGENERIC_RESY * 4);
+
+    DG_Init ();
+
+    I_SetPalette (palette);
+    box_set_palette ();
+}
+
+
+int main (int argc, char **argv)
+{
+    static const int	scalings[] = { 2, 4, 8 };
+    static byte		palette[256 * 3];
+    FILE*		results;
+    int			frames;
+    int			s;
+    int			k;
+    int			i;
+    int			p;
+
+    myargc = argc;
+    myargv = argv;
+
+    I_AtExit (Quit, true);
+
+    p = M_CheckParmWithArgs ("-frames", 1);
+    frames = p ? atoi (myargv[p+1]) : 200;
+
+    // the frames go to /dev/null, the results where stdout was
+    results = fdopen (dup (STDOUT_FILENO), "w");
+    dup2 (open ("/dev/null", O_WRONLY), STDOUT_FILENO);
+
+    I_VideoBuffer = malloc (SCREENWIDTH * SCREENHEIGHT);
+
+    srand (1);
+
+    for (i = 0; i < SCREENWIDTH * SCREENHEIGHT; i++)
+	I_VideoBuffer[i] = rand ();
+
+    for (i = 0; i < 256 * 3; i++)
+	palette[i] = rand ();
+
+    fprintf (results, "%-8s %8s", "scaling", "indexed");
+    for (k = 0; k < NUMKERNELS; k++)
+	fprintf (results, " %7s%-4s", "box ", kernels[k].name);
+    fprintf (results, "\n");
+
+    for (s = 0; s < (int) (sizeof(scalings) / sizeof(*scalings)); s++)
+    {
+	SetScaling (scalings[s], palette);
+
+	box_filter = false;
+	fprintf (results, "%-8i %8.1f", fb_scaling, TimeFrames (frames));
+
+	box_filter = true;
+
+	for (k = 0; k < NUMKERNELS; k++)
+	{
+	    if (!Supported (&kernels[k]))
+	    {
+		fprintf (results, " %11s", "-");
+		continue;
+	    }
+
+	    box_accumulate = kernels[k].accumulate;
+	    box_reduce = kernels[k].reduce;
+
+	    fprintf (results, " %11.1f", TimeFrames (frames));
+
+	    // all kernels give the same image
+	    if (k == 0)
+		memcpy (reference, DG_ScreenBuffer, s_Fb.xres * s_Fb.yres * 4);
+	    else if (memcmp (reference, DG_ScreenBuffer, s_Fb.xres * s_Fb.yres * 4))
+		fprintf (results, " (differs from scalar)");
+	}
+
+	fprintf (results, "\n");
+    }
+
+    return 0;
+}
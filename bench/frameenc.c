@@ -0,0 +1,214 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Frame encoding benchmark.
+//	Times turning a fixed 320x200 frame into terminal output
+//	 in each -chars and -colors mode, as it was done before
+//	 cells were built from palette indices, by scaling the
+//	 frame to RGB in DG_ScreenBuffer for DG_DrawFrame, and
+//	 as it is done now, by DG_DrawIndexedFrame. The output
+//	 is written to /dev/null.
+//
+//	frameenc [-frames <n>] [-scaling <n>]
+//
+//	Prints the best of five runs, in us per frame.
+//
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "doomgeneric.h"
+#include "doomtype.h"
+#include "i_system.h"
+#include "i_video.h"
+#include "m_argv.h"
+
+
+#define RUNS	5
+
+static byte	frame[SCREENWIDTH * SCREENHEIGHT];
+static uint32_t	palette[256];
+static int	scaling;
+
+
+// I_Error waits forever once it is done, so leave before that
+static void Quit (void)
+{
+    exit (1);
+}
+
+
+static uint64_t NowNS (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+//
+// RGBFrame
+// The top left pixel of each block to DG_ScreenBuffer,
+//  as cmap_to_fb in i_video.c did, then DG_DrawFrame.
+//
+static void RGBFrame (void)
+{
+    uint32_t*	out;
+    byte*	in;
+    unsigned	x;
+    unsigned	y;
+
+    out = DG_ScreenBuffer;
+
+    for (y = 0; y < DOOMGENERIC_RESY; y++)
+    {
+	in = frame + y * scaling * SCREENWIDTH;
+
+	for (x = 0; x < DOOMGENERIC_RESX; x++, in += scaling)
+	    *out++ = palette[*in];
+    }
+
+    DG_DrawFrame ();
+}
+
+
+static void IndexedFrame (void)
+{
+    DG_DrawIndexedFrame (frame, SCREENWIDTH, scaling);
+}
+
+
+static double TimeFrames (void (*draw)(void), int frames)
+{
+    uint64_t	start;
+    uint64_t	best;
+    uint64_t	time;
+    int		run;
+    int		i;
+
+    best = UINT64_MAX;
+
+    for (run = 0; run < RUNS; run++)
+    {
+	start = NowNS ();
+
+	for (i = 0; i < frames; i++)
+	    draw ();
+
+	time = NowNS () - start;
+
+	if (time < best)
+	    best = time;
+    }
+
+    return best / 1000.0 / frames;
+}
+
+
+//
+// MakeFrame
+// Runs of one color of up to 16 pixels,
+//  like the spans and columns of a real frame.
+//
+static void MakeFrame (void)
+{
+    int		i;
+    int		run;
+    byte	color;
+
+    srand (1);
+
+    for (i = 0; i < 256; i++)
+	palette[i] = rand () & 0xffffff;
+
+    for (i = 0; i < SCREENWIDTH * SCREENHEIGHT; i += run)
+    {
+	run = 1 + rand () % 16;
+	color = rand ();
+
+	if (run > SCREENWIDTH * SCREENHEIGHT - i)
+	    run = SCREENWIDTH * SCREENHEIGHT - i;
+
+	memset (frame + i, color, run);
+    }
+}
+
+
+int main (int argc, char **argv)
+{
+    static char*	charsets[] = { "ascii", "block", "braille", "halfblock" };
+    static char*	colors[] = { "truecolor", "256", "16" };
+    static char*	args[6];
+    FILE*		results;
+    double		rgb;
+    double		indexed;
+    int			frames;
+    int			c;
+    int			k;
+    int			p;
+
+    myargc = argc;
+    myargv = argv;
+
+    I_AtExit (Quit, true);
+
+    p = M_CheckParmWithArgs ("-frames", 1);
+    frames = p ? atoi (myargv[p+1]) : 200;
+
+    p = M_CheckParmWithArgs ("-scaling", 1);
+    scaling = p ? atoi (myargv[p+1]) : 4;
+
+    DOOMGENERIC_RESX = SCREENWIDTH / scaling;
+    DOOMGENERIC_RESY = SCREENHEIGHT / scaling;
+    DG_ScreenBuffer = malloc (DOOMGENERIC_RESX * DOOMGENERIC_RESY * 4);
+
+    MakeFrame ();
+
+    // the frames go to /dev/null, the results where stdout was
+    results = fdopen (dup (STDOUT_FILENO), "w");
+    dup2 (open ("/dev/null", O_WRONLY), STDOUT_FILENO);
+
+    fprintf (results, "%-10s %-10s %8s %8s\n", "chars", "colors", "rgb", "indexed");
+
+    // DG_Init reads the mode from the arguments
+    args[0] = argv[0];
+    args[1] = "-chars";
+    args[3] = "-colors";
+    myargc = 5;
+    myargv = args;
+
+    for (c = 0; c < (int) (sizeof(charsets) / sizeof(*charsets)); c++)
+    {
+	for (k = 0; k < (int) (sizeof(colors) / sizeof(*colors)); k++)
+	{
+	    args[2] = charsets[c];
+	    args[4] = colors[k];
+
+	    DG_Init ();
+	    DG_SetPalette (palette);
+
+	    rgb = TimeFrames (RGBFrame, frames);
+	    indexed = TimeFrames (IndexedFrame, frames);
+
+	    fprintf (results, "%-10s %-10s %8.1f %8.1f\n",
+		     charsets[c], colors[k], rgb, indexed);
+	}
+    }
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Vissprite sorting benchmark.
+//	Times R_SortVisSprites against the selection sort it
+//	 replaced, on scenes of up to 16384 sprites with random
+//	 scales, many of them equal, and checks that both give
+//	 the same order.
+//
+//	vsprsort [-runs <n>]
+//
+//	Prints the best of the runs, in us per sort.
+//
+
+
+#include <time.h>
+
+#include "m_argv.h"
+
+// for its statics
+#include "r_things.c"
+
+
+static vissprite_t**	order;
+
+
+static uint64_t NowNS (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+//
+// SelectionSortVisSprites
+// R_SortVisSprites as it was, pulling out the
+//  lowest scale left once for each sprite.
+//
+static void SelectionSortVisSprites (void)
+{
+    int			i;
+    int			count;
+    vissprite_t*	ds;
+    vissprite_t*	best;
+    vissprite_t		unsorted;
+    fixed_t		bestscale;
+
+    count = vissprite_p - vissprites;
+
+    unsorted.next = unsorted.prev = &unsorted;
+
+    if (!count)
+	return;
+
+    for (ds=vissprites ; ds<vissprite_p ; ds++)
+    {
+	ds->next = ds+1;
+	ds->prev = ds-1;
+    }
+
+    vissprites[0].prev = &unsorted;
+    unsorted.next = &vissprites[0];
+    (vissprite_p-1)->next = &unsorted;
+    unsorted.prev = vissprite_p-1;
+
+    // pull the vissprites out by scale
+
+    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
+    for (i=0 ; i<count ; i++)
+    {
+	bestscale = INT_MAX;
+        best = unsorted.next;
+	for (ds=unsorted.next ; ds!= &unsorted ; ds=ds->next)
+	{
+	    if (ds->scale < bestscale)
+	    {
+		bestscale = ds->scale;
+		best = ds;
+	    }
+	}
+	best->next->prev = best->prev;
+	best->prev->next = best->next;
+	best->next = &vsprsortedhead;
+	best->prev = vsprsortedhead.prev;
+	vsprsortedhead.prev->next = best;
+	vsprsortedhead.prev = best;
+    }
+}
+
+
+//
+// MakeScene
+// Count sprites with scales of a quarter as
+//  many values, so that many are equal.
+//
+static void MakeScene (int count)
+{
+    vissprite_t*	vis;
+    int			i;
+
+    srand (count);
+
+    R_ClearSprites ();
+
+    for (i = 0 ; i < count ; i++)
+    {
+	vis = R_NewVisSprite ();
+	vis->scale = FRACUNIT/64 + (rand () % (count/4 + 1)) * (FRACUNIT/256);
+    }
+}
+
+
+static double TimeSort (void (*sort)(void), int count, int runs)
+{
+    uint64_t	start;
+    uint64_t	best;
+    uint64_t	time;
+    int		run;
+
+    best = UINT64_MAX;
+
+    for (run = 0 ; run < runs ; run++)
+    {
+	// each run sorts the scene as it was made
+	MakeScene (count);
+
+	start = NowNS ();
+	sort ();
+	time = NowNS () - start;
+
+	if (time < best)
+	    best = time;
+    }
+
+    return best / 1000.0;
+}
+
+
+static bool SameOrder (int count)
+{
+    vissprite_t*	spr;
+    int			i;
+
+    i = 0;
+
+    for (spr = vsprsortedhead.next ; spr != &vsprsortedhead ; spr = spr->next)
+	if (i == count || order[i++] != spr)
+	    return false;
+
+    return i == count;
+}
+
+
+int main (int argc, char **argv)
+{
+    static const int	counts[] = { 16, 128, 1024, 4096, 16384 };
+    vissprite_t*	spr;
+    double		selection;
+    double		merge;
+    int			runs;
+    int			count;
+    int			i;
+    int			p;
+
+    myargc = argc;
+    myargv = argv;
+
+    p = M_CheckParmWithArgs ("-runs", 1);
+    runs = p ? atoi (myargv[p+1]) : 5;
+
+    order = malloc (counts[sizeof(counts)/sizeof(*counts) - 1] * sizeof(*order));
+
+    printf ("%8s %14s %14s\n", "sprites", "selection us", "merge us");
+
+    for (i = 0 ; i < (int) (sizeof(counts)/sizeof(*counts)) ; i++)
+    {
+	count = counts[i];
+
+	// the quadratic sort takes long enough once
+	selection = TimeSort (SelectionSortVisSprites, count,
+			      count > 1024 ? 1 : runs);
+
+	p = 0;
+	for (spr = vsprsortedhead.next ; spr != &vsprsortedhead ; spr = spr->next)
+	    order[p++] = spr;
+
+	merge = TimeSort (R_SortVisSprites, count, runs);
+
+	printf ("%8i %14.1f %14.1f%s\n", count, selection, merge,
+		SameOrder (count) ? "" : "  (order differs)");
+    }
+
+    return 0;
+}
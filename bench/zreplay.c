@@ -0,0 +1,583 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Zone allocation benchmark.
+//	Replays a trace written with -ztrace against the zone,
+//	 and prints how long each Z_Malloc took.
+//
+//	zreplay [-mb <mb>] [-zindex] [-zarena] [-zgrow]
+//	        [-fill <percent>] [-repeat <n>] <trace>
+//
+//	-fill first fills the given percentage of the zone with
+//	 static and cached blocks of random sizes, leaving holes
+//	 between them, as after a long game.
+//	The trace is replayed -repeat times, freeing what is left
+//	 of each pass before the next.
+//
+//	Objects from slabs and arenas are not replayed, as their
+//	 memory is in the trace as the slab or chunk they came from.
+//	Record traces without -zarena: its chunks are freed by
+//	 Z_FreeTags without being traced, so in a replay they
+//	 would never be freed.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "doomtype.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "z_zone.h"
+
+
+// the record of a -ztrace file, see TRACE in z_zone.c
+
+enum
+{
+    ZT_FILE,
+    ZT_MALLOC,
+    ZT_FREE,
+    ZT_CHANGETAG,
+    ZT_PURGE,
+    ZT_FREETAGS,
+    ZT_OBJECT,
+    ZT_OBJFREE
+};
+
+typedef struct
+{
+    uint8_t		event;
+    uint8_t		tag;
+    uint16_t		file;
+    int32_t		line;
+    int32_t		size;
+    uint32_t		time;
+    uint64_t		ptr;
+} zonetrace_t;
+
+
+// What is replayed, with blocks numbered in the order they were made.
+// For ZT_FREETAGS, size is the low tag and tag the high tag, and the
+//  blocks it frees are count numbers from first in freedblocks.
+
+typedef struct
+{
+    int			event;
+    int			tag;
+    int			size;
+    int			block;
+    int			first;
+    int			count;
+} replayop_t;
+
+typedef struct
+{
+    uint64_t		ptr;
+    int			tag;
+    bool		user;	// made with one, as it becomes purgable
+} replayblock_t;
+
+static replayop_t*	ops;
+static int		numops;
+static int		maxops;
+
+static replayblock_t*	blocks;
+static int		numblocks;
+static int		maxblocks;
+
+static int*		freedblocks;
+static int		numfreed;
+static int		maxfreed;
+
+// the blocks made and not yet freed in the trace, by pointer
+static int*		livemap;
+static int		livemapsize;
+static int		numlive;
+
+// during the replay
+static void**		slots;
+static int*		slottags;
+
+static uint32_t*	samples;
+static int		numsamples;
+
+static int		headersize;
+
+
+static void *Grow (void* array, int* max, int size)
+{
+    *max = *max ? *max * 2 : 1024;
+    array = realloc (array, *max * size);
+
+    if (!array)
+	I_Error ("zreplay: out of memory");
+
+    return array;
+}
+
+
+static unsigned int HashPtr (uint64_t ptr)
+{
+    ptr ^= ptr >> 33;
+    ptr *= 0xff51afd7ed558ccdull;
+    ptr ^= ptr >> 33;
+
+    return (unsigned int) ptr;
+}
+
+
+//
+// FindLive
+// The slot of the live map holding ptr, or the empty one it would go in.
+//
+static int FindLive (uint64_t ptr)
+{
+    int		i;
+
+    i = HashPtr (ptr) & (livemapsize - 1);
+
+    while (livemap[i] >= 0 && blocks[livemap[i]].ptr != ptr)
+	i = (i + 1) & (livemapsize - 1);
+
+    return i;
+}
+
+
+static void AddLive (int block)
+{
+    int*	old;
+    int		oldsize;
+    int		i;
+
+    if (numlive * 2 >= livemapsize)
+    {
+	old = livemap;
+	oldsize = livemapsize;
+
+	livemapsize = livemapsize ? livemapsize * 2 : 1024;
+	livemap = malloc (livemapsize * sizeof(*livemap));
+	if (!livemap)
+	    I_Error ("zreplay: out of memory");
+	memset (livemap, -1, livemapsize * sizeof(*livemap));
+
+	for (i=0 ; i<oldsize ; i++)
+	    if (old[i] >= 0)
+		livemap[FindLive (blocks[old[i]].ptr)] = old[i];
+
+	free (old);
+    }
+
+    livemap[FindLive (blocks[block].ptr)] = block;
+    numlive++;
+}
+
+
+//
+// RemoveLive
+// Takes the block with ptr out of the live map,
+//  returning its number, or -1 if it is not there.
+//
+static int RemoveLive (uint64_t ptr)
+{
+    int		i;
+    int		j;
+    int		k;
+    int		block;
+
+    if (!numlive)
+	return -1;
+
+    i = FindLive (ptr);
+    block = livemap[i];
+
+    if (block < 0)
+	return -1;
+
+    // move up the blocks after it that belong before the hole
+    for (j = (i + 1) & (livemapsize - 1) ;
+	 livemap[j] >= 0 ;
+	 j = (j + 1) & (livemapsize - 1))
+    {
+	k = HashPtr (blocks[livemap[j]].ptr) & (livemapsize - 1);
+
+	if (((j - k) & (livemapsize - 1)) >= ((j - i) & (livemapsize - 1)))
+	{
+	    livemap[i] = livemap[j];
+	    i = j;
+	}
+    }
+
+    livemap[i] = -1;
+    numlive--;
+
+    return block;
+}
+
+
+static replayop_t *NewOp (int event, int tag, int size, int block)
+{
+    replayop_t*	op;
+
+    if (numops == maxops)
+	ops = Grow (ops, &maxops, sizeof(*ops));
+
+    op = &ops[numops++];
+    op->event = event;
+    op->tag = tag;
+    op->size = size;
+    op->block = block;
+    op->first = op->count = 0;
+
+    return op;
+}
+
+
+//
+// LoadTrace
+// Reads the trace into ops, pairing each free
+//  and change of tag with the malloc it is for.
+//
+static void LoadTrace (char* name)
+{
+    FILE*		f;
+    char		magic[8];
+    int32_t		recsize;
+    zonetrace_t		rec;
+    replayop_t*		op;
+    int			block;
+    int			i;
+
+    f = fopen (name, "rb");
+
+    if (!f)
+	I_Error ("zreplay: could not open %s", name);
+
+    if (fread (magic, 1, 8, f) != 8
+     || memcmp (magic, "ZTRACE\0\0", 8)
+     || fread (&recsize, sizeof(recsize), 1, f) != 1
+     || recsize != sizeof(zonetrace_t))
+	I_Error ("zreplay: %s is not a zone trace of this build", name);
+
+    while (fread (&rec, sizeof(rec), 1, f) == 1)
+    {
+	switch (rec.event)
+	{
+	  case ZT_FILE:
+	    fseek (f, rec.size, SEEK_CUR);
+	    break;
+
+	  case ZT_MALLOC:
+	    if (numblocks == maxblocks)
+		blocks = Grow (blocks, &maxblocks, sizeof(*blocks));
+
+	    block = numblocks++;
+	    blocks[block].ptr = rec.ptr;
+	    blocks[block].tag = rec.tag;
+	    blocks[block].user = rec.tag >= PU_PURGELEVEL;
+	    AddLive (block);
+
+	    NewOp (ZT_MALLOC, rec.tag, rec.size, block);
+	    break;
+
+	  case ZT_FREE:
+	    block = RemoveLive (rec.ptr);
+	    if (block >= 0)
+		NewOp (ZT_FREE, 0, 0, block);
+	    break;
+
+	  case ZT_CHANGETAG:
+	    // blocks changing tag are given a user, so that they can
+	    //  become purgable, and stay out of the -zarena arenas
+	    block = livemap ? livemap[FindLive (rec.ptr)] : -1;
+	    if (block >= 0)
+	    {
+		blocks[block].tag = rec.tag;
+		blocks[block].user = true;
+		NewOp (ZT_CHANGETAG, rec.tag, 0, block);
+	    }
+	    break;
+
+	  case ZT_PURGE:
+	    // the replay purges what it has to by itself
+	    RemoveLive (rec.ptr);
+	    break;
+
+	  case ZT_FREETAGS:
+	    op = NewOp (ZT_FREETAGS, rec.tag, rec.size, -1);
+	    op->first = numfreed;
+
+	    for (i=0 ; i<livemapsize ; i++)
+	    {
+		block = livemap[i];
+
+		if (block >= 0
+		 && blocks[block].tag >= rec.size && blocks[block].tag <= rec.tag)
+		{
+		    if (numfreed == maxfreed)
+			freedblocks = Grow (freedblocks, &maxfreed, sizeof(int));
+		    freedblocks[numfreed++] = block;
+		}
+	    }
+
+	    op->count = numfreed - op->first;
+
+	    for (i=op->first ; i<numfreed ; i++)
+		RemoveLive (blocks[freedblocks[i]].ptr);
+	    break;
+
+	  default:
+	    // objects from slabs and arenas
+	    break;
+	}
+    }
+
+    fclose (f);
+}
+
+
+// I_Error waits forever once it is done, so leave before that
+static void Quit (void)
+{
+    exit (1);
+}
+
+
+static uint64_t NowNS (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+//
+// FindHeaderSize
+// The first two blocks of an empty zone are next to each other.
+//
+static void FindHeaderSize (void)
+{
+    byte*	a;
+    byte*	b;
+
+    a = Z_Malloc (64, PU_STATIC, NULL);
+    b = Z_Malloc (64, PU_STATIC, NULL);
+
+    headersize = b - a - 64;
+
+    Z_Free (a);
+    Z_Free (b);
+}
+
+
+//
+// FillZone
+// Fills percent of the zone with static and cached blocks,
+//  freeing every third static one to leave holes.
+//
+static void FillZone (int percent)
+{
+    static void**	cached;
+    void*		statics[3];
+    int64_t		target;
+    int64_t		filled;
+    unsigned int	seed;
+    int			numcached;
+    int			size;
+    int			i;
+
+    target = (int64_t) Z_ZoneSize () * percent / 100;
+    cached = malloc ((target / 64 + 1) * sizeof(*cached));
+    if (!cached)
+	I_Error ("zreplay: out of memory");
+
+    seed = 1;
+    numcached = 0;
+    filled = 0;
+
+    while (filled < target)
+    {
+	for (i=0 ; i<3 ; i++)
+	{
+	    seed = seed * 1103515245 + 12345;
+	    size = 64 + (seed >> 8) % 16384;
+	    statics[i] = Z_Malloc (size, PU_STATIC, NULL);
+	    filled += size + headersize;
+
+	    seed = seed * 1103515245 + 12345;
+	    size = 64 + (seed >> 8) % 16384;
+	    Z_Malloc (size, PU_CACHE, &cached[numcached++]);
+	    filled += size + headersize;
+	}
+
+	Z_Free (statics[1]);
+    }
+}
+
+
+//
+// Replay
+// One pass over the trace, leaving the zone as it was.
+//
+static void Replay (void)
+{
+    replayop_t*	op;
+    void**	user;
+    uint64_t	start;
+    uint32_t	time;
+    int		i;
+
+    for (op = ops ; op < ops + numops ; op++)
+    {
+	switch (op->event)
+	{
+	  case ZT_MALLOC:
+	    user = blocks[op->block].user ? &slots[op->block] : NULL;
+
+	    start = NowNS ();
+	    slots[op->block] = Z_Malloc (op->size - headersize, op->tag, user);
+	    time = NowNS () - start;
+
+	    samples[numsamples++] = time;
+	    slottags[op->block] = op->tag;
+	    break;
+
+	  case ZT_FREE:
+	    if (slots[op->block])
+		Z_Free (slots[op->block]);
+	    slots[op->block] = NULL;
+	    break;
+
+	  case ZT_CHANGETAG:
+	    if (slots[op->block])
+	    {
+		Z_ChangeTag (slots[op->block], op->tag);
+		slottags[op->block] = op->tag;
+	    }
+	    break;
+
+	  case ZT_FREETAGS:
+	    Z_FreeTags (op->size, op->tag);
+
+	    for (i=op->first ; i<op->first+op->count ; i++)
+		slots[freedblocks[i]] = NULL;
+	    break;
+	}
+    }
+
+    // free what the trace left, level blocks all at once
+    Z_FreeTags (PU_LEVEL, PU_PURGELEVEL-1);
+
+    for (i=0 ; i<numblocks ; i++)
+    {
+	if (slots[i] && (slottags[i] < PU_LEVEL || slottags[i] >= PU_PURGELEVEL))
+	    Z_Free (slots[i]);
+	slots[i] = NULL;
+    }
+}
+
+
+static int CompareSamples (const void* a, const void* b)
+{
+    uint32_t	x = *(const uint32_t *) a;
+    uint32_t	y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+static uint32_t Percentile (double p)
+{
+    int		i;
+
+    i = (int) (numsamples * p);
+
+    if (i >= numsamples)
+	i = numsamples - 1;
+
+    return samples[i];
+}
+
+
+int main (int argc, char** argv)
+{
+    uint64_t	total;
+    uint64_t	start;
+    uint64_t	elapsed;
+    int		repeat;
+    int		fill;
+    int		p;
+    int		i;
+
+    myargc = argc;
+    myargv = argv;
+
+    I_AtExit (Quit, true);
+
+    if (argc < 2 || argv[argc-1][0] == '-')
+    {
+	fprintf (stderr, "usage: zreplay [-mb <mb>] [-zindex] [-zarena] [-zgrow] "
+		 "[-fill <percent>] [-repeat <n>] <trace>\n");
+	return 1;
+    }
+
+    p = M_CheckParmWithArgs ("-repeat", 1);
+    repeat = p ? atoi (myargv[p+1]) : 1;
+
+    p = M_CheckParmWithArgs ("-fill", 1);
+    fill = p ? atoi (myargv[p+1]) : 0;
+
+    LoadTrace (argv[argc-1]);
+
+    Z_Init ();
+    FindHeaderSize ();
+
+    if (fill)
+	FillZone (fill);
+
+    slots = calloc (numblocks + 1, sizeof(*slots));
+    slottags = calloc (numblocks + 1, sizeof(*slottags));
+    samples = malloc (((int64_t) numblocks * repeat + 1) * sizeof(*samples));
+
+    if (!slots || !slottags || !samples)
+	I_Error ("zreplay: out of memory");
+
+    start = NowNS ();
+
+    for (i=0 ; i<repeat ; i++)
+	Replay ();
+
+    elapsed = NowNS () - start;
+
+    Z_CheckHeap ();
+
+    if (!numsamples)
+	I_Error ("zreplay: no mallocs in the trace");
+
+    total = 0;
+    for (i=0 ; i<numsamples ; i++)
+	total += samples[i];
+
+    qsort (samples, numsamples, sizeof(*samples), CompareSamples);
+
+    printf ("%i ops, %i mallocs in %i passes, %.1f ms\n",
+	    numops, numsamples, repeat, elapsed / 1e6);
+    printf ("Z_Malloc ns: mean %.0f  p50 %u  p99 %u  p99.9 %u  max %u\n",
+	    (double) total / numsamples, Percentile (0.5), Percentile (0.99),
+	    Percentile (0.999), samples[numsamples-1]);
+
+    return 0;
+}
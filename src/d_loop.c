@@ -114,23 +114,25 @@ static bool local_playeringame[NET_MAXPLAYERS];
 static int player_class;
 
 
-// 35 fps clock adjusted by offsetms milliseconds
+// 35 fps clock adjusted by offsetms milliseconds.
+// Counted in us, so that tics start at the same
+// time as in I_GetTime and I_SleepUntilTic.
 
 static int GetAdjustedTime(void)
 {
-    int time_ms;
+    int64_t time_us;
 
-    time_ms = I_GetTimeMS();
+    time_us = I_GetTimeUS();
 
     if (new_sync)
     {
 	// Use the adjustments from net_client.c only if we are
 	// using the new sync mode.
 
-        time_ms += (offsetms / FRACUNIT);
+        time_us += (int64_t) (offsetms / FRACUNIT) * 1000;
     }
 
-    return (time_ms * TICRATE) / 1000;
+    return (time_us * TICRATE) / 1000000;
 }
 
 static bool BuildNewTic(void)
@@ -781,7 +783,17 @@ void TryRunTics (void)
 	    return;
 	}
 
-        I_Sleep(1);
+        // Without other players, nothing can arrive
+        // before the next tic is built.
+
+        if (net_client_connected)
+        {
+            I_Sleep(1);
+        }
+        else
+        {
+            I_SleepUntilTic(I_GetTime() + 1);
+        }
     }
 
     // run the count * ticdup dics
@@ -131,6 +131,19 @@ int             show_endoom = 1;
 void D_ConnectNetGame(void);
 void D_CheckNetGame(void);
 
+// Most frames drawn per second, 0 for one every tic,
+//  see -fps and -idlefps.
+static int	maxfps;
+static int	idlefps;
+
+// Only draw a frame after a tic has run.
+static bool	ticdraw;
+
+// Deadlines of the frames drawn since displaystart.
+static int	displayfps;
+static int	displaystart;
+static int	displayframes;
+
 
 //
 // D_ProcessEvents
@@ -215,12 +228,12 @@ void D_Display (void)
 			break;
 		if (automapactive)
 			AM_Drawer ();
-		if (wipe || (viewheight != 200 && fullscreen) )
+		if (wipe || (scaledviewheight != 200 && fullscreen) )
 			redrawsbar = true;
 		if (inhelpscreensstate && !inhelpscreens)
 			redrawsbar = true;              // just put away the help screen
-		ST_Drawer (viewheight == 200, redrawsbar );
-		fullscreen = viewheight == 200;
+		ST_Drawer (scaledviewheight == 200, redrawsbar );
+		fullscreen = scaledviewheight == 200;
 		break;
 
       case GS_INTERMISSION:
@@ -316,7 +329,8 @@ void D_Display (void)
 	{
 	    nowtime = I_GetTime ();
 	    tics = nowtime - wipestart;
-            I_Sleep(1);
+	    if (tics <= 0)
+		I_SleepUntilTic (nowtime + 1);
 	} while (tics <= 0);
 
 	wipestart = nowtime;
@@ -402,11 +416,63 @@ bool D_GrabMouseCallback(void)
     return (gamestate == GS_LEVEL) && !demoplayback && !advancedemo;
 }
 
+//
+// D_DisplayDue
+// Returns true if the frame rate limit allows
+//  drawing a frame now.
+//
+static bool D_DisplayDue (void)
+{
+    int		fps;
+    int		now;
+    int		next;
+
+    fps = maxfps;
+
+    if (idlefps && (paused || menuactive) && (!fps || idlefps < fps))
+	fps = idlefps;
+
+    if (!fps)
+	return true;
+
+    now = I_GetTimeMS ();
+
+    if (fps != displayfps)
+    {
+	displayfps = fps;
+	displaystart = now;
+	displayframes = 0;
+    }
+
+    next = displaystart + displayframes*1000/fps;
+
+    if (now < next)
+	return false;
+
+    // more than a frame late, start counting again
+    if (now - next >= 1000/fps)
+    {
+	displaystart = now;
+	displayframes = 0;
+    }
+
+    if (++displayframes == fps)
+    {
+	displaystart += 1000;
+	displayframes = 0;
+    }
+
+    return true;
+}
+
+
 //
 //  D_DoomLoop
 //
 void D_DoomLoop (void)
 {
+    int		oldgametic;
+
     if (bfgedition &&
         (demorecording || (gameaction == ga_playdemo) || netgame))
     {
@@ -444,12 +510,15 @@ void D_DoomLoop (void)
 		// frame syncronous IO operations
 		I_StartFrame ();
 
+		oldgametic = gametic;
 		TryRunTics (); // will run at least one tic
 
 		S_UpdateSounds (players[consoleplayer].mo);// move positional sounds
 
 		// Update display, next frame, with current state.
-		if (screenvisible)
+		if (screenvisible
+		    && (!ticdraw || gametic != oldgametic)
+		    && D_DisplayDue ())
 		{
 			D_Display ();
 		}
@@ -1268,6 +1337,159 @@ void D_DoomMain (void)
 
     devparm = M_CheckParm ("-devparm");
 
+    //!
+    // Render the 3D view at the output resolution set by -scaling,
+    // instead of rendering it at 320x200 and discarding most pixels.
+    //
+
+    nativeres = M_CheckParm ("-nativeres") > 0;
+
+    //!
+    // @arg <n>
+    //
+    // Render the 3D view on n threads, each drawing a vertical strip
+    // of the screen.
+    //
+
+    p = M_CheckParmWithArgs ("-rthreads", 1);
+
+    if (p)
+    {
+	rthreads = atoi(myargv[p+1]);
+
+	if (rthreads < 1)
+	    rthreads = 1;
+    }
+
+    //!
+    // Find everything to draw in the 3D view first, then draw it
+    // on the threads set by -rthreads.
+    //
+
+    deferdraw = M_CheckParm ("-deferdraw") > 0;
+
+    //!
+    // On exit, print the most visplanes, openings, drawsegs and
+    // sprites the 3D view needed in one frame.
+    //
+
+    rstats = M_CheckParm ("-rstats") > 0;
+
+    //!
+    // Redraw the 3D view only when something in it has changed,
+    // showing the last frame again otherwise.
+    //
+
+    reuseview = M_CheckParm ("-reuseview") > 0;
+
+    //!
+    // @arg <n>
+    //
+    // Draw at most n frames per second. The game still runs at
+    // 35 tics per second.
+    //
+
+    p = M_CheckParmWithArgs ("-fps", 1);
+
+    if (p)
+    {
+	maxfps = atoi(myargv[p+1]);
+
+	if (maxfps < 1 || maxfps > TICRATE)
+	    maxfps = 0;
+    }
+
+    //!
+    // @arg <n>
+    //
+    // Draw at most n frames per second while the game is paused or
+    // the menu is open.
+    //
+
+    p = M_CheckParmWithArgs ("-idlefps", 1);
+
+    if (p)
+    {
+	idlefps = atoi(myargv[p+1]);
+
+	if (idlefps < 1 || idlefps > TICRATE)
+	    idlefps = 0;
+    }
+
+    //!
+    // Only draw a frame when a game tic has run since the last one.
+    // Otherwise a frame is also drawn whenever TryRunTics stops
+    // waiting for the next tic.
+    //
+
+    ticdraw = M_CheckParm ("-ticdraw") > 0;
+
+    //!
+    // @arg <kb>
+    //
+    // Keep wall textures out of the zone, using up to kb kilobytes.
+    // The textures of each level are composed into one block when it
+    // is loaded, others when first drawn, dropping the least recently
+    // drawn ones to stay within the limit.
+    //
+
+    p = M_CheckParmWithArgs ("-texatlas", 1);
+
+    if (p)
+    {
+	texatlasbudget = atoi(myargv[p+1]);
+
+	if (texatlasbudget < 0)
+	    texatlasbudget = 0;
+	if (texatlasbudget > 1024*1024)
+	    texatlasbudget = 1024*1024;
+
+	texatlasbudget *= 1024;
+    }
+
+    //!
+    // @arg <kb>
+    //
+    // Keep up to kb kilobytes of floor and ceiling textures with
+    // lighting already applied, so that they draw faster.
+    //
+
+    p = M_CheckParmWithArgs ("-litflats", 1);
+
+    if (p)
+    {
+	litflatbudget = atoi(myargv[p+1]);
+
+	if (litflatbudget < 0)
+	    litflatbudget = 0;
+	if (litflatbudget > 1024*1024)
+	    litflatbudget = 1024*1024;
+
+	litflatbudget *= 1024;
+    }
+
+    //!
+    // @arg <variant>
+    //
+    // Use the given column and span drawers, to compare their speed.
+    // Valid values are "scalar", "unrolled" and "avx2". By default
+    // the fastest one the CPU supports is used.
+    //
+
+    p = M_CheckParmWithArgs ("-drawers", 1);
+
+    if (p)
+    {
+	if (!strcmp(myargv[p+1], "scalar"))
+	    drawvariant = drawvariant_scalar;
+	else if (!strcmp(myargv[p+1], "unrolled"))
+	    drawvariant = drawvariant_unrolled;
+	else if (!strcmp(myargv[p+1], "avx2"))
+	    drawvariant = drawvariant_avx2;
+	else
+	    I_Error("Unknown drawers '%s'", myargv[p+1]);
+    }
+
     I_DisplayFPSDots(devparm);
 
     //!
@@ -10,8 +10,12 @@ extern uint32_t *DG_ScreenBuffer;
 
 void DG_Init(void);
 void DG_DrawFrame(void);
+void DG_DrawIndexedFrame(const uint8_t *frame, unsigned pitch, unsigned step);
+void DG_SetPalette(const uint32_t *palette);
 void DG_SleepMs(uint32_t ms);
+void DG_SleepUntilUs(uint64_t us);
 uint32_t DG_GetTicksMs(void);
+uint64_t DG_GetTicksUs(void);
 int DG_GetKey(int *pressed, unsigned char *key);
 void DG_SetWindowTitle(const char *title);
 void DG_ReadInput(void);
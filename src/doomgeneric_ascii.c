@@ -18,10 +18,12 @@
 #include "doomgeneric.h"
 #include "doomkeys.h"
 #include "i_system.h"
+#include "i_thread.h"
 #include "m_argv.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <locale.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -33,6 +35,12 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -59,40 +67,57 @@ static void winError(char *const format)
 	I_Error(format, lpMsgBuf);
 }
 
-/* Modified from https://stackoverflow.com/a/31335254 */
 struct timespec {
 	long tv_sec;
 	long tv_nsec;
 };
 
+/* Monotonic, so that changes to the system time do not affect the game */
 static int clock_gettime(const int p, struct timespec *const spec)
 {
 	(void)p;
-	__int64 wintime;
-	GetSystemTimeAsFileTime((FILETIME *)&wintime);
-	wintime -= 116444736000000000ll;
-	spec->tv_sec = wintime / 10000000ll;
-	spec->tv_nsec = wintime % 10000000ll * 100;
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	spec->tv_sec = count.QuadPart / freq.QuadPart;
+	spec->tv_nsec = count.QuadPart % freq.QuadPart * 1000000000ll / freq.QuadPart;
 	return 0;
 }
 
 #else
-#define CLK CLOCK_REALTIME
+#define CLK CLOCK_MONOTONIC
 #define dg_random random
 #endif
 
+#ifdef OS_WINDOWS
+#define THREAD_FUNC(name) DWORD WINAPI name(LPVOID arg)
+typedef LPTHREAD_START_ROUTINE thread_func_t;
+#else
+#define THREAD_FUNC(name) void *name(void *arg)
+typedef void *(*thread_func_t)(void *);
+#endif
+
 #ifdef __GNUC__
 #define UNLIKELY(x) __builtin_expect((x), 0)
 #else
 #define UNLIKELY(x) (x)
 #endif
 
+#ifdef __GNUC__
+#define ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#else
+#define ATOMIC_LOAD(ptr) (*(volatile unsigned *)(ptr))
+#define ATOMIC_STORE(ptr, val) (*(volatile unsigned *)(ptr) = (val))
+#endif
+
 #define CALL(stmt, format)                                                                         \
 	do {                                                                                       \
 		if (UNLIKELY(stmt))                                                                \
 			I_Error(format, errno);                                                    \
 	} while (0)
-#define CALL_STDOUT(stmt, format) CALL((stmt) == EOF, format)
 
 #define BUF_ITOA(buf, byte)                                                                        \
 	do {                                                                                       \
@@ -114,14 +139,24 @@ static int clock_gettime(const int p, struct timespec *const spec)
 		*(buf)++ = c;                                                                      \
 	} while (0)
 
+#define BUF_UTOA(buf, n)                                                                           \
+	do {                                                                                       \
+		(buf) = bufUtoa(buf, n);                                                           \
+	} while (0)
+
 #define static_strlen(s) (sizeof(s) - 1)
 
 enum {
 	UNICODE_GRAD_LEN = 4U,
-	INPUT_BUFFER_LEN = 16U,
-	EVENT_BUFFER_LEN = 257U,
+	INPUT_RING_LEN = 256U,
+	CSI_MAX_LEN = 16U,
+	KEY_QUEUE_LEN = 256U,
+	ESC_TIMEOUT_MS = 30U,
 	RGB_SUM_MAX = 776U,
 	DEMO_MAX_MS = 600000U,
+	WINDOW_TITLE_LEN = 256U,
+	DELTA_REFRESH_FRAMES = 256U,
+	WRITER_STOP_MS = 1000U,
 };
 
 static const char grad[] =
@@ -134,6 +169,8 @@ static const char *braille_grads[] = { "\u2801\u2802\u2804\u2808\u2810\u2820\u28
 	"\u281f\u282f\u2837\u283b\u283d\u283e\u284f\u2857\u285b\u285d\u285e\u2867\u286b\u286d\u286e\u2873\u2875\u2876\u2879\u287a\u287c\u288f\u2897\u289b\u289d\u289e\u28a7\u28ab\u28ad\u28ae\u28b3\u28b5\u28b6\u28b9\u28ba\u28bc\u28c7\u28cb\u28cd\u28ce\u28d3\u28d5\u28d6\u28d9\u28da\u28dc\u28e3\u28e5\u28e6\u28e9\u28ea\u28ec\u28f1\u28f2\u28f4\u28f8",
 	"\u283f\u285f\u286f\u2877\u287b\u287d\u287e\u289f\u28af\u28b7\u28bb\u28bd\u28be\u28cf\u28d7\u28db\u28dd\u28de\u28e7\u28eb\u28ed\u28ee\u28f3\u28f5\u28f6\u28f9\u28fa\u28fc",
 	"\u287f\u28bf\u28df\u28ef\u28f7\u28fb\u28fd\u28fe", "\u28ff" };
+static const char *const half_block_glyphs[] = { " ", "\u2584", "\u2580", "\u2588" };
+static const uint8_t half_block_glyph_lengths[] = { 1, 3, 3, 3 };
 static const size_t braille_grad_lengths[] = { static_strlen(braille_grads[0]),
 	static_strlen(braille_grads[1]), static_strlen(braille_grads[2]),
 	static_strlen(braille_grads[3]), static_strlen(braille_grads[4]),
@@ -164,29 +201,251 @@ struct color_t {
 	uint32_t a : 8;
 };
 
-struct event_buffer_t {
-	bool pressed;
+/* Everything emitted for a single pixel: its color, and the glyphs it is drawn with. With
+ * -chars halfblock, a cell holds two pixels, color being the top one and bg the bottom one. */
+struct cell_t {
+	uint32_t color;
+	uint32_t bg;
+	uint8_t len;
+	char glyph[7];
+};
+
+/* Colors set by the last SGR code */
+struct pen_t {
+	uint32_t fg;
+	uint32_t bg;
+};
+
+struct key_event_t {
+	struct timespec time;
 	unsigned char key;
 };
 
-enum character_set_t { ASCII, BLOCK, BRAILLE };
+enum character_set_t { ASCII, BLOCK, BRAILLE, HALFBLOCK };
+
+enum color_mode_t { TRUECOLOR, COLOR_256, COLOR_16 };
+
+/* "RRR;" for every channel value, from which truecolor SGR codes are assembled */
+static char sgr_digits[256][4];
+
+/* RGB of the xterm-256 palette. Only the first 16 entries are used with -colors 16, and only the
+ * rest with -colors 256, as the first 16 depend on the terminal's theme. */
+static uint32_t term_colors[256];
+
+/* Nearest terminal color for every RGB555 value, built when first needed by buildCells */
+static uint8_t *term_color_cache;
+
+/* Cells for every palette index, rebuilt by DG_SetPalette. Braille gradient glyphs are picked at
+ * random per cell, so only their gradient level is stored. */
+static struct cell_t palette_cells[256];
+static uint8_t palette_braille[256];
+static bool palette_braille_enabled;
 
 static char *output_buffer;
 static size_t output_buffer_size;
+static struct cell_t *cells;
+static struct cell_t *prev_cells;
+static uint32_t *cell_seeds;
+static unsigned frames_since_refresh;
+
+/* Frames handed over to the writer thread. The game thread builds cells, swaps them with
+ * ready_cells, and the writer thread swaps ready_cells with write_cells before encoding them. */
+static struct cell_t *ready_cells;
+static struct cell_t *write_cells;
+static bool frame_ready;
+static unsigned frames_dropped;
+static bool writer_running;
+static bool writer_stop;
+static bool writer_stopped;
+static char *writer_error_format; /* of a write error on the writer thread, or NULL */
+static int writer_error;
+static THREAD_LOCAL bool on_writer_thread;
+static char window_title[WINDOW_TITLE_LEN];
+static bool window_title_ready;
+#ifdef OS_WINDOWS
+static CRITICAL_SECTION frame_lock;
+static HANDLE frame_event;
+#else
+static pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frame_cond = PTHREAD_COND_INITIALIZER;
+#endif
 static struct timespec ts_init;
 
-static struct timespec input_buffer[256] = { 0 };
-static struct event_buffer_t event_buffer[EVENT_BUFFER_LEN] = { 0 };
-static struct event_buffer_t *event_buf_loc;
+/* Single-producer single-consumer queue of keys as they are read, by the input thread or by
+ * DG_ReadInput, from which DG_GetKey makes events */
+static struct key_event_t key_queue[KEY_QUEUE_LEN];
+static unsigned key_queue_head; /* next event to consume, written by the game thread */
+static unsigned key_queue_tail; /* next event to produce, written by the reading thread */
+
+/* Terminals only report keys being hit, so a key counts as held until it has not been hit for
+ * keypress_smoothing_ms. Held keys are listed in held_keys, in no particular order. */
+static bool key_held[256];
+static struct timespec key_hit_time[256];
+static unsigned char held_keys[256];
+static unsigned n_held_keys;
+static struct timespec input_time; /* of the last DG_ReadInput, against which keys are released */
+
+#ifndef OS_WINDOWS
+static struct termios orig_termios;
+static unsigned char input_ring[INPUT_RING_LEN];
+static unsigned input_head; /* next byte to decode */
+static unsigned input_tail; /* next byte to read into */
+static unsigned input_pending_tail;
+static bool input_pending;
+#endif
 
 static bool color_enabled;
 static enum character_set_t character_set = ASCII;
+static enum color_mode_t color_mode = TRUECOLOR;
+static unsigned cell_rows;
+static unsigned cell_width = 2;
 static bool gradient_enabled;
 static bool bold_enabled;
 static bool erase_enabled;
 static bool gamma_correct_enabled;
+static bool delta_enabled;
+static bool input_thread_enabled;
+static bool async_write_enabled;
+#ifndef OS_WINDOWS
+static bool stdout_is_socket;
+static bool stdin_is_tty;
+#endif
+static unsigned refresh_frames = DELTA_REFRESH_FRAMES;
 static unsigned keypress_smoothing_ms = 42;
 
+static char *bufUtoa(char *buf, unsigned n)
+{
+	char tmp[10];
+	char *t = tmp;
+	do {
+		*t++ = '0' + n % 10u;
+		n /= 10u;
+	} while (n);
+	while (t != tmp)
+		*buf++ = *--t;
+	return buf;
+}
+
+static size_t utoaLen(unsigned n)
+{
+	size_t len = 1;
+	while (n >= 10u) {
+		n /= 10u;
+		len++;
+	}
+	return len;
+}
+
+static void initTermColors(void)
+{
+	static const uint32_t ansi_colors[16] = { 0x000000, 0xCD0000, 0x00CD00, 0xCDCD00, 0x0000EE,
+		0xCD00CD, 0x00CDCD, 0xE5E5E5, 0x7F7F7F, 0xFF0000, 0x00FF00, 0xFFFF00, 0x5C5CFF,
+		0xFF00FF, 0x00FFFF, 0xFFFFFF };
+	static const uint8_t cube_levels[6] = { 0, 95, 135, 175, 215, 255 };
+	unsigned i;
+
+	memcpy(term_colors, ansi_colors, sizeof(ansi_colors));
+	for (i = 0; i < 216; i++)
+		term_colors[16 + i] = (uint32_t)cube_levels[i / 36] << 16
+			| cube_levels[i / 6 % 6] << 8 | cube_levels[i % 6];
+	for (i = 0; i < 24; i++)
+		term_colors[232 + i] = (8 + i * 10) * 0x010101U;
+}
+
+/* Length of the SGR parameters selecting a color, including their trailing separator */
+static inline size_t colorLen(const uint32_t color, const bool bg)
+{
+	switch (color_mode) {
+	case TRUECOLOR:
+		return static_strlen("38;2;RRR;GGG;BBB;");
+	case COLOR_256:
+		return static_strlen("38;5;NNN;");
+	case COLOR_16:
+		return (bg && color >= 8) ? static_strlen("10N;") : static_strlen("3N;");
+	}
+	return 0;
+}
+
+static THREAD_FUNC(inputThread);
+static THREAD_FUNC(writerThread);
+
+static void startThread(const thread_func_t func)
+{
+#ifdef OS_WINDOWS
+	const HANDLE thread = CreateThread(NULL, 0, func, NULL, 0, NULL);
+	WINDOWS_CALL(!thread, "startThread: %s");
+	CloseHandle(thread);
+#else
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, func, NULL);
+	if (UNLIKELY(err))
+		I_Error("startThread: pthread_create error %d", err);
+	err = pthread_detach(thread);
+	if (UNLIKELY(err))
+		I_Error("startThread: pthread_detach error %d", err);
+#endif
+}
+
+static inline void frameLock(void)
+{
+#ifdef OS_WINDOWS
+	EnterCriticalSection(&frame_lock);
+#else
+	pthread_mutex_lock(&frame_lock);
+#endif
+}
+
+static inline void frameUnlock(void)
+{
+#ifdef OS_WINDOWS
+	LeaveCriticalSection(&frame_lock);
+#else
+	pthread_mutex_unlock(&frame_lock);
+#endif
+}
+
+/* Wake the writer thread. Must be called with frame_lock held. */
+static inline void frameSignal(void)
+{
+#ifdef OS_WINDOWS
+	SetEvent(frame_event);
+#else
+	pthread_cond_signal(&frame_cond);
+#endif
+}
+
+/* Wait for frameSignal. Must be called with frame_lock held, which is released while waiting. */
+static inline void frameWait(void)
+{
+#ifdef OS_WINDOWS
+	LeaveCriticalSection(&frame_lock);
+	WaitForSingleObject(frame_event, INFINITE);
+	EnterCriticalSection(&frame_lock);
+#else
+	pthread_cond_wait(&frame_cond, &frame_lock);
+#endif
+}
+
+/* frameWait, giving up after ms */
+static inline void frameWaitMs(const unsigned ms)
+{
+#ifdef OS_WINDOWS
+	LeaveCriticalSection(&frame_lock);
+	WaitForSingleObject(frame_event, ms);
+	EnterCriticalSection(&frame_lock);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(&frame_cond, &frame_lock, &ts);
+#endif
+}
+
 static int64_t sub_timespec_ms(
 	const struct timespec *const time1, const struct timespec *const time0)
 {
@@ -194,10 +453,36 @@ static int64_t sub_timespec_ms(
 		+ (time1->tv_nsec - time0->tv_nsec) / 1000000L;
 }
 
+/* Let the writer thread finish the write in progress and stop, so that nothing else reaches the
+ * terminal. A write to a terminal that is not being read never finishes, so the writer is given up
+ * on after WRITER_STOP_MS. When exiting from the writer thread itself, it is not writing anymore. */
+static void stopWriter(void)
+{
+	if (!writer_running || on_writer_thread)
+		return;
+
+	const uint64_t deadline = DG_GetTicksUs() + WRITER_STOP_MS * 1000U;
+
+	frameLock();
+	writer_stop = true;
+	frameSignal();
+	while (!writer_stopped) {
+		const uint64_t now = DG_GetTicksUs();
+		if (now >= deadline)
+			break;
+		frameWaitMs((deadline - now + 999) / 1000);
+	}
+	frameUnlock();
+}
+
 void DG_AtExit(void)
 {
+	stopWriter();
+
 	if (color_enabled || bold_enabled)
 		(void)fputs("\033[0m", stdout);
+	if (async_write_enabled)
+		(void)printf("\nFrames dropped: %u\n", frames_dropped);
 
 #ifdef OS_WINDOWS
 	DWORD mode;
@@ -206,14 +491,11 @@ void DG_AtExit(void)
 		return;
 	if (UNLIKELY(!GetConsoleMode(hInputHandle, &mode)))
 		return;
-	mode |= ENABLE_ECHO_INPUT;
+	mode |= ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT;
 	SetConsoleMode(hInputHandle, mode);
 #else
-	struct termios t;
-	if (UNLIKELY(tcgetattr(STDIN_FILENO, &t)))
-		return;
-	t.c_lflag |= ECHO;
-	tcsetattr(STDIN_FILENO, TCSANOW, &t);
+	if (stdin_is_tty)
+		tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
 #endif
 }
 
@@ -231,13 +513,20 @@ void DG_Init(void)
 	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, "DG_Init: %s");
 	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &mode), "DG_Init: %s");
 	mode &= ~(ENABLE_MOUSE_INPUT | ENABLE_WINDOW_INPUT | ENABLE_QUICK_EDIT_MODE
-		| ENABLE_ECHO_INPUT);
+		| ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT);
 	WINDOWS_CALL(!SetConsoleMode(hInputHandle, mode), "DG_Init: %s");
 #else
-	struct termios t;
-	CALL(tcgetattr(STDIN_FILENO, &t), "DG_Init: tcgetattr error %d");
-	t.c_lflag &= ~(ECHO);
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &t), "DG_Init: tcsetattr error %d");
+	/* Disable echo and canonical mode, and make reads return immediately. Input that is not a
+	 * terminal, such as that of the benchmarks, is read as it is. */
+	stdin_is_tty = isatty(STDIN_FILENO);
+	if (stdin_is_tty) {
+		CALL(tcgetattr(STDIN_FILENO, &orig_termios), "DG_Init: tcgetattr error %d");
+		struct termios t = orig_termios;
+		t.c_lflag &= ~(ECHO | ICANON);
+		t.c_cc[VMIN] = 0;
+		t.c_cc[VTIME] = 0;
+		CALL(tcsetattr(STDIN_FILENO, TCSANOW, &t), "DG_Init: tcsetattr error %d");
+	}
 #endif
 	CALL(atexit(&DG_AtExit), "DG_Init: atexit error %d");
 
@@ -246,6 +535,9 @@ void DG_Init(void)
 	bold_enabled = M_CheckParm("-nobold") == 0;
 	erase_enabled = M_CheckParm("-erase") > 0;
 	gamma_correct_enabled = M_CheckParm("-fixgamma") > 0;
+	delta_enabled = M_CheckParm("-delta") > 0 && !erase_enabled;
+	input_thread_enabled = M_CheckParm("-inputthread") > 0;
+	async_write_enabled = M_CheckParm("-asyncwrite") > 0;
 
 	int i = M_CheckParmWithArgs("-chars", 1);
 	if (i > 0) {
@@ -255,15 +547,34 @@ void DG_Init(void)
 			character_set = BLOCK;
 		} else if (!strcmp("braille", myargv[i + 1])) {
 			character_set = BRAILLE;
+		} else if (!strcmp("halfblock", myargv[i + 1])) {
+			character_set = HALFBLOCK;
 		} else {
 			I_Error("Unrecognized argument for -chars: '%s'", myargv[i + 1]);
 		}
 	}
 
+	i = M_CheckParmWithArgs("-colors", 1);
+	if (i > 0) {
+		if (!strcmp("truecolor", myargv[i + 1])) {
+			color_mode = TRUECOLOR;
+		} else if (!strcmp("256", myargv[i + 1])) {
+			color_mode = COLOR_256;
+		} else if (!strcmp("16", myargv[i + 1])) {
+			color_mode = COLOR_16;
+		} else {
+			I_Error("Unrecognized argument for -colors: '%s'", myargv[i + 1]);
+		}
+	}
+
 	i = M_CheckParmWithArgs("-kpsmooth", 1);
 	if (i > 0)
 		keypress_smoothing_ms = atoi(myargv[i + 1]);
 
+	i = M_CheckParmWithArgs("-refresh", 1);
+	if (i > 0)
+		refresh_frames = atoi(myargv[i + 1]);
+
 	if (character_set != ASCII) {
 #ifdef OS_WINDOWS
 		WINDOWS_CALL(!SetConsoleOutputCP(CP_UTF8), "DG_Init: %s");
@@ -273,129 +584,688 @@ void DG_Init(void)
 #endif
 	}
 
-	/* Longest per-pixel SGR code: \033[38;2;RRR;GGG;BBBm (length 19)
-	 * 2 Chars per pixel
+	/* Longest per-pixel SGR code: \033[38;2;RRR;GGG;BBBm (length 19), \033[38;5;NNNm (length 11),
+	 * or \033[9Nm (length 5). With -chars halfblock, it may set the background color as well.
+	 * 2 Chars per pixel, or a single half block
 	 * 1 Newline character per line
-	 * 1 NUL terminator
+	 * SGR clear screen code on first frame: \033[1;1H\033[2J (length 10)
 	 * SGR move cursor code: \033[;H (length 4)
 	 * SGR clear code: \033[0m (length 4)
 	 * SGR bold code: \033[1m (length 4)
 	 * SGR erase code: \033[2J (length 4)
+	 *
+	 * In delta mode, each pixel may additionally be preceded by a cursor jump, which is never
+	 * longer than the absolute move \033[RRR;CCCH (length 10).
 	 */
-	output_buffer_size = ((color_enabled ? 19U : 0U) + (character_set == ASCII ? 2U : 6U))
-			* DOOMGENERIC_RESX * DOOMGENERIC_RESY
-		+ DOOMGENERIC_RESY + 1U + 4U + (bold_enabled ? 4U : 0U) + (erase_enabled ? 4U : 0U)
+	if (character_set == HALFBLOCK) {
+		cell_rows = (DOOMGENERIC_RESY + 1U) / 2U;
+		cell_width = 1;
+	} else {
+		cell_rows = DOOMGENERIC_RESY;
+	}
+	const size_t sgr_len = static_strlen("\033[") + colorLen(15, false)
+		+ (character_set == HALFBLOCK ? colorLen(15, true) : 0U);
+	const size_t glyph_len = character_set == ASCII ? 2U : character_set == HALFBLOCK ? 3U : 6U;
+	output_buffer_size = ((color_enabled ? sgr_len : 0U) + glyph_len + (delta_enabled ? 10U : 0U))
+			* DOOMGENERIC_RESX * cell_rows
+		+ cell_rows + 10U + 4U + (bold_enabled ? 4U : 0U) + (erase_enabled ? 4U : 0U)
 		+ ((color_enabled || bold_enabled) ? 4U : 0U);
 	output_buffer = malloc(output_buffer_size);
 
+	for (i = 0; i < 256; i++) {
+		char *buf = sgr_digits[i];
+		BUF_ITOA(buf, (unsigned)i);
+		BUF_PUTCHAR(buf, ';');
+	}
+
+	initTermColors();
+
+	const size_t n_cells = (size_t)DOOMGENERIC_RESX * cell_rows;
+	cells = calloc(n_cells, sizeof(*cells));
+	if (async_write_enabled) {
+		ready_cells = calloc(n_cells, sizeof(*ready_cells));
+		write_cells = calloc(n_cells, sizeof(*write_cells));
+	}
+	if (delta_enabled) {
+		prev_cells = calloc(n_cells, sizeof(*prev_cells));
+
+		/* Braille glyphs are picked at random. Fix the choice per cell, as otherwise every
+		 * cell would differ from the previous frame. */
+		if (character_set == BRAILLE) {
+			cell_seeds = malloc(n_cells * 2 * sizeof(*cell_seeds));
+			size_t j;
+			for (j = 0; j < n_cells * 2; j++)
+				cell_seeds[j] = dg_random();
+		}
+	}
+
 	CALL(clock_gettime(CLK, &ts_init), "DG_Init: clock_gettime error %d");
+
+#ifndef OS_WINDOWS
+	struct stat st;
+	stdout_is_socket = !fstat(STDOUT_FILENO, &st) && S_ISSOCK(st.st_mode);
+#endif
+
+	if (input_thread_enabled)
+		startThread(&inputThread);
+
+	if (async_write_enabled) {
+#ifdef OS_WINDOWS
+		InitializeCriticalSection(&frame_lock);
+		frame_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		WINDOWS_CALL(!frame_event, "DG_Init: %s");
+#endif
+		writer_running = true;
+		startThread(&writerThread);
+	}
 }
 
-void DG_DrawFrame(void)
+/* Find the terminal color closest to an RGB color, like FindNearestColor in i_scale.c */
+static uint8_t nearestTermColor(const unsigned r, const unsigned g, const unsigned b)
 {
-	/* Clear screen if first frame */
-	static bool first_frame = true;
-	if (first_frame) {
-		first_frame = false;
-		CALL_STDOUT(fputs("\033[1;1H\033[2J", stdout), "DG_DrawFrame: fputs error %d");
+	const unsigned first = color_mode == COLOR_16 ? 0 : 16;
+	const unsigned last = color_mode == COLOR_16 ? 16 : 256;
+	unsigned best = first;
+	int best_diff = INT_MAX;
+	unsigned i;
+
+	for (i = first; i < last; i++) {
+		const int dr = (int)r - (int)(term_colors[i] >> 16);
+		const int dg = (int)g - (int)(term_colors[i] >> 8 & 0xFFu);
+		const int db = (int)b - (int)(term_colors[i] & 0xFFu);
+		const int diff = dr * dr + dg * dg + db * db;
+
+		if (diff == 0)
+			return i;
+		if (diff < best_diff) {
+			best = i;
+			best_diff = diff;
+		}
 	}
 
-#ifdef DG_DEMO
-	struct timespec now;
-	CALL(clock_gettime(CLK, &now), "DG_DrawFrame: clock_gettime error %d");
-	if (sub_timespec_ms(&now, &ts_init) > DEMO_MAX_MS) {
-		puts("\033[;H\033[2JThe telnet demo of doom-ascii is limited to 10 minutes, as computational\nresources don't grow on trees. Thank you for playing!\n- Wojciech Graj <me@w-graj.net>");
-		exit(0);
+	return best;
+}
+
+static void initTermColorCache(void)
+{
+	unsigned i;
+
+	term_color_cache = malloc(1U << 15);
+	for (i = 0; i < 1U << 15; i++) {
+		const unsigned r = i >> 10, g = i >> 5 & 0x1Fu, b = i & 0x1Fu;
+		term_color_cache[i] = nearestTermColor(r << 3 | r >> 2, g << 3 | g >> 2, b << 3 | b >> 2);
 	}
-#endif /* DG_DEMO */
+}
+
+/* Set the color and glyphs of a cell. Returns the braille gradient level if the glyphs are yet to
+ * be picked by putBraille, or 0. */
+static unsigned makeCell(struct cell_t *const cell, const struct color_t pixel)
+{
+	*cell = (struct cell_t){ .color = (uint32_t)pixel.r << 16 | pixel.g << 8 | pixel.b };
+	char *buf = cell->glyph;
+
+	switch (character_set) {
+	case ASCII:
+		if (gradient_enabled) {
+			const char v_char
+				= grad[(pixel.r + pixel.g + pixel.b) * static_strlen(grad) / RGB_SUM_MAX];
+			BUF_PUTCHAR(buf, v_char);
+			BUF_PUTCHAR(buf, v_char);
+		} else {
+			BUF_PUTS(buf, "##");
+		}
+		break;
+	case BLOCK:
+		if (gradient_enabled) {
+			const size_t idx
+				= (pixel.r + pixel.g + pixel.b) * (UNICODE_GRAD_LEN + 1U) / RGB_SUM_MAX;
+			if (idx) {
+				const void *const v_char = &unicode_grad[(idx - 1) * 3];
+				BUF_MEMCPY(buf, v_char, 3);
+				BUF_MEMCPY(buf, v_char, 3);
+			} else {
+				BUF_PUTS(buf, "  ");
+			}
+		} else {
+			BUF_PUTS(buf, "\u2588\u2588");
+		}
+		break;
+	case BRAILLE:
+		if (gradient_enabled) {
+			const unsigned idx = (pixel.r + pixel.g + pixel.b) * 8 / RGB_SUM_MAX;
+			if (idx)
+				return idx;
+			BUF_PUTS(buf, "  ");
+		} else {
+			BUF_PUTS(buf, "\u28ff\u28ff");
+		}
+		break;
+	case HALFBLOCK:
+		/* Only used without color, to tell apart light and dark pixels */
+		if ((pixel.r + pixel.g + pixel.b) * 2U >= RGB_SUM_MAX)
+			BUF_PUTS(buf, "\u2588");
+		else
+			BUF_PUTCHAR(buf, ' ');
+		break;
+	}
+
+	cell->len = buf - cell->glyph;
+	return 0;
+}
 
-	uint32_t color = 0x00FFFFFF;
+/* Pick the glyphs of the i-th cell from braille gradient level idx */
+static inline void putBraille(struct cell_t *const cell, const unsigned idx, const size_t i)
+{
+	const char *const gradient = braille_grads[idx - 1];
+	const size_t len = braille_grad_lengths[idx - 1] / 3;
+	const size_t r0 = cell_seeds ? cell_seeds[i * 2] : dg_random();
+	const size_t r1 = cell_seeds ? cell_seeds[i * 2 + 1] : dg_random();
+	memcpy(cell->glyph, &gradient[(r0 % len) * 3], 3);
+	memcpy(cell->glyph + 3, &gradient[(r1 % len) * 3], 3);
+	cell->len = 6;
+}
+
+/* Combine the cells of two vertically adjacent pixels into a half block cell */
+static inline void makeHalfBlock(
+	struct cell_t *const cell, const struct cell_t *const top, const struct cell_t *const bottom)
+{
+	*cell = (struct cell_t){ .color = top->color, .bg = bottom->color };
+	if (!color_enabled) {
+		const unsigned idx = (top->len > 1) << 1 | (bottom->len > 1);
+		cell->len = half_block_glyph_lengths[idx];
+		memcpy(cell->glyph, half_block_glyphs[idx], cell->len);
+	}
+}
+
+/* Set the i-th cell from a pixel of DG_ScreenBuffer */
+static inline void makePixelCell(struct cell_t *const cell, struct color_t pixel, const size_t i)
+{
+	if (gamma_correct_enabled) {
+		pixel.r = byte_sqrt[pixel.r];
+		pixel.g = byte_sqrt[pixel.g];
+		pixel.b = byte_sqrt[pixel.b];
+	}
+
+	const unsigned idx = makeCell(cell, pixel);
+	if (color_mode != TRUECOLOR)
+		cell->color = term_color_cache[pixel.r >> 3 << 10 | pixel.g >> 3 << 5 | pixel.b >> 3];
+	if (idx)
+		putBraille(cell, idx, i);
+}
+
+static void buildCells(void)
+{
+	const struct color_t *pixel = (const struct color_t *)DG_ScreenBuffer;
+	struct cell_t *cell = cells;
 	unsigned row, col;
-	struct color_t *pixel = (struct color_t *)DG_ScreenBuffer;
-	char *buf = output_buffer;
 
-	/* fill output buffer */
-	BUF_PUTS(buf, "\033[;H"); /* move cursor to top left corner */
-	if (erase_enabled)
-		BUF_PUTS(buf, "\033[2J");
-	if (bold_enabled)
-		BUF_PUTS(buf, "\033[1m");
-	for (row = 0; row < DOOMGENERIC_RESY; row++) {
-		for (col = 0; col < DOOMGENERIC_RESX; col++) {
-			if (gamma_correct_enabled) {
-				pixel->r = byte_sqrt[pixel->r];
-				pixel->g = byte_sqrt[pixel->g];
-				pixel->b = byte_sqrt[pixel->b];
+	if (color_mode != TRUECOLOR && !term_color_cache)
+		initTermColorCache();
+
+	if (character_set == HALFBLOCK) {
+		for (row = 0; row < cell_rows; row++, pixel += DOOMGENERIC_RESX * 2U) {
+			const bool has_bottom = row * 2U + 1U < DOOMGENERIC_RESY;
+			for (col = 0; col < DOOMGENERIC_RESX; col++) {
+				struct cell_t top, bottom;
+				makePixelCell(&top, pixel[col], 0);
+				if (has_bottom)
+					makePixelCell(&bottom, pixel[DOOMGENERIC_RESX + col], 0);
+				makeHalfBlock(cell++, &top, has_bottom ? &bottom : &top);
 			}
+		}
+		return;
+	}
 
-			if (color_enabled && (color ^ *(uint32_t *)pixel) & 0x00FFFFFF) {
-				BUF_PUTS(buf, "\033[38;2;");
-				BUF_ITOA(buf, pixel->r);
-				BUF_PUTCHAR(buf, ';');
-				BUF_ITOA(buf, pixel->g);
-				BUF_PUTCHAR(buf, ';');
-				BUF_ITOA(buf, pixel->b);
-				BUF_PUTCHAR(buf, 'm');
-				color = *(uint32_t *)pixel;
+	const size_t n_cells = (size_t)DOOMGENERIC_RESX * DOOMGENERIC_RESY;
+	size_t i;
+	for (i = 0; i < n_cells; i++)
+		makePixelCell(cell++, *pixel++, i);
+}
+
+/* Build cells from palette indices, sampling every step-th pixel of every step-th row */
+static void buildIndexedCells(const uint8_t *frame, const unsigned pitch, const unsigned step)
+{
+	struct cell_t *cell = cells;
+	unsigned row, col;
+
+	if (character_set == HALFBLOCK) {
+		for (row = 0; row < cell_rows; row++, frame += (size_t)pitch * step * 2U) {
+			const uint8_t *top = frame;
+			const uint8_t *bottom
+				= row * 2U + 1U < DOOMGENERIC_RESY ? frame + (size_t)pitch * step : frame;
+			for (col = 0; col < DOOMGENERIC_RESX; col++, top += step, bottom += step)
+				makeHalfBlock(cell++, &palette_cells[*top], &palette_cells[*bottom]);
+		}
+		return;
+	}
+
+	for (row = 0; row < DOOMGENERIC_RESY; row++, frame += (size_t)pitch * step) {
+		const uint8_t *in = frame;
+		if (palette_braille_enabled) {
+			for (col = 0; col < DOOMGENERIC_RESX; col++, in += step, cell++) {
+				*cell = palette_cells[*in];
+				if (palette_braille[*in])
+					putBraille(cell, palette_braille[*in], cell - cells);
 			}
+		} else {
+			for (col = 0; col < DOOMGENERIC_RESX; col++, in += step)
+				*cell++ = palette_cells[*in];
+		}
+	}
+}
 
-			switch (character_set) {
-			case ASCII:
-				if (gradient_enabled) {
-					const char v_char = grad[(pixel->r + pixel->g + pixel->b)
-						* static_strlen(grad) / RGB_SUM_MAX];
-					BUF_PUTCHAR(buf, v_char);
-					BUF_PUTCHAR(buf, v_char);
-				} else {
-					BUF_PUTS(buf, "##");
-				}
-				break;
-			case BLOCK:
-				if (gradient_enabled) {
-					const size_t idx = (pixel->r + pixel->g + pixel->b)
-						* (UNICODE_GRAD_LEN + 1U) / RGB_SUM_MAX;
-					if (idx) {
-						const void *const v_char =
-							&unicode_grad[(idx - 1) * 3];
-						BUF_MEMCPY(buf, v_char, 3);
-						BUF_MEMCPY(buf, v_char, 3);
-					} else {
-						BUF_PUTS(buf, "  ");
-					}
-				} else {
-					BUF_PUTS(buf, "\u2588\u2588");
-				}
-				break;
-			case BRAILLE:
-				if (gradient_enabled) {
-					const size_t idx =
-						(pixel->r + pixel->g + pixel->b) * 8 / RGB_SUM_MAX;
-					if (idx) {
-						const char *const gradient = braille_grads[idx - 1];
-						const size_t len =
-							braille_grad_lengths[idx - 1] / 3;
-						BUF_MEMCPY(
-							buf, &gradient[(dg_random() % len) * 3], 3);
-						BUF_MEMCPY(
-							buf, &gradient[(dg_random() % len) * 3], 3);
-					} else {
-						BUF_PUTS(buf, "  ");
-					}
+static inline char *putColor(char *buf, const uint32_t color, const bool bg)
+{
+	switch (color_mode) {
+	case TRUECOLOR:
+		BUF_MEMCPY(buf, bg ? "48;2;" : "38;2;", 5);
+		BUF_MEMCPY(buf, sgr_digits[color >> 16 & 0xFFu], 4);
+		BUF_MEMCPY(buf, sgr_digits[color >> 8 & 0xFFu], 4);
+		BUF_MEMCPY(buf, sgr_digits[color & 0xFFu], 4);
+		break;
+	case COLOR_256:
+		BUF_MEMCPY(buf, bg ? "48;5;" : "38;5;", 5);
+		BUF_MEMCPY(buf, sgr_digits[color], 4);
+		break;
+	case COLOR_16:
+		if (color < 8)
+			BUF_PUTCHAR(buf, bg ? '4' : '3');
+		else if (bg)
+			BUF_PUTS(buf, "10");
+		else
+			BUF_PUTCHAR(buf, '9');
+		BUF_PUTCHAR(buf, '0' + (color & 7u));
+		BUF_PUTCHAR(buf, ';');
+		break;
+	}
+	return buf;
+}
+
+static inline size_t penCost(const struct pen_t *const pen, const struct pen_t *const next)
+{
+	if (next->fg == pen->fg && next->bg == pen->bg)
+		return 0;
+	return static_strlen("\033[") + (next->fg != pen->fg ? colorLen(next->fg, false) : 0U)
+		+ (next->bg != pen->bg ? colorLen(next->bg, true) : 0U);
+}
+
+/* Emit a single SGR code changing pen to next */
+static inline char *putPen(char *buf, struct pen_t *const pen, const struct pen_t *const next)
+{
+	if (next->fg == pen->fg && next->bg == pen->bg)
+		return buf;
+	BUF_PUTS(buf, "\033[");
+	if (next->fg != pen->fg)
+		buf = putColor(buf, next->fg, false);
+	if (next->bg != pen->bg)
+		buf = putColor(buf, next->bg, true);
+	buf[-1] = 'm';
+	*pen = *next;
+	return buf;
+}
+
+/* Pick the half block glyph and colors drawing a cell with the fewest color changes. Returns the
+ * index into half_block_glyphs. */
+static inline unsigned halfBlock(
+	const struct cell_t *const cell, const struct pen_t *const pen, struct pen_t *const next)
+{
+	const uint32_t top = cell->color;
+	const uint32_t bottom = cell->bg;
+
+	*next = *pen;
+	if (top == bottom) {
+		if (pen->bg == top)
+			return 0;
+		if (pen->fg == top)
+			return 3;
+		next->bg = top;
+		return 0;
+	}
+	if ((pen->fg != top) + (pen->bg != bottom) <= (pen->fg != bottom) + (pen->bg != top)) {
+		*next = (struct pen_t){ .fg = top, .bg = bottom };
+		return 2;
+	}
+	*next = (struct pen_t){ .fg = bottom, .bg = top };
+	return 1;
+}
+
+static inline size_t cellCost(const struct cell_t *const cell, struct pen_t *const pen)
+{
+	if (!color_enabled)
+		return cell->len;
+
+	struct pen_t next = { .fg = cell->color, .bg = pen->bg };
+	size_t cost = cell->len;
+	if (character_set == HALFBLOCK)
+		cost = half_block_glyph_lengths[halfBlock(cell, pen, &next)];
+	cost += penCost(pen, &next);
+	*pen = next;
+	return cost;
+}
+
+static inline char *putCell(char *buf, const struct cell_t *const cell, struct pen_t *const pen)
+{
+	if (!color_enabled) {
+		BUF_MEMCPY(buf, cell->glyph, cell->len);
+		return buf;
+	}
+
+	if (character_set == HALFBLOCK) {
+		struct pen_t next;
+		const unsigned idx = halfBlock(cell, pen, &next);
+		buf = putPen(buf, pen, &next);
+		BUF_MEMCPY(buf, half_block_glyphs[idx], half_block_glyph_lengths[idx]);
+		return buf;
+	}
+
+	const struct pen_t next = { .fg = cell->color, .bg = pen->bg };
+	buf = putPen(buf, pen, &next);
+	BUF_MEMCPY(buf, cell->glyph, cell->len);
+	return buf;
+}
+
+/* The pen is assumed to be white on an unknown background at the start of a frame */
+static const struct pen_t pen_init = { .fg = 0x00FFFFFF, .bg = UINT32_MAX };
+
+static char *encodeFull(char *buf, const struct cell_t *cell)
+{
+	struct pen_t pen = pen_init;
+	unsigned row, col;
+
+	for (row = 0; row < cell_rows; row++) {
+		for (col = 0; col < DOOMGENERIC_RESX; col++)
+			buf = putCell(buf, cell++, &pen);
+		BUF_PUTCHAR(buf, '\n');
+	}
+	return buf;
+}
+
+/* Only emit cells which differ from those in prev. Gaps of unchanged cells within a row are either
+ * skipped with a cursor movement, or reprinted if that takes fewer bytes. */
+static char *encodeDelta(char *buf, const struct cell_t *const cur, const struct cell_t *const prev)
+{
+	struct pen_t pen = pen_init;
+	unsigned row, col;
+
+	for (row = 0; row < cell_rows; row++) {
+		const struct cell_t *const line = &cur[(size_t)row * DOOMGENERIC_RESX];
+		const struct cell_t *const prev_line = &prev[(size_t)row * DOOMGENERIC_RESX];
+		unsigned cursor = DOOMGENERIC_RESX; /* cursor is not in this row */
+
+		for (col = 0; col < DOOMGENERIC_RESX; col++) {
+			if (!memcmp(&line[col], &prev_line[col], sizeof(struct cell_t)))
+				continue;
+
+			if (cursor == DOOMGENERIC_RESX) {
+				BUF_PUTS(buf, "\033[");
+				BUF_UTOA(buf, row + 1U);
+				BUF_PUTCHAR(buf, ';');
+				BUF_UTOA(buf, col * cell_width + 1U);
+				BUF_PUTCHAR(buf, 'H');
+			} else if (cursor != col) {
+				const size_t jump_cost
+					= static_strlen("\033[C") + utoaLen((col - cursor) * cell_width);
+				struct pen_t gap_pen = pen;
+				size_t gap_cost = 0;
+				unsigned i;
+				for (i = cursor; i < col && gap_cost <= jump_cost; i++)
+					gap_cost += cellCost(&line[i], &gap_pen);
+
+				if (gap_cost <= jump_cost) {
+					for (i = cursor; i < col; i++)
+						buf = putCell(buf, &line[i], &pen);
 				} else {
-					BUF_PUTS(buf, "\u28ff\u28ff");
+					BUF_PUTS(buf, "\033[");
+					BUF_UTOA(buf, (col - cursor) * cell_width);
+					BUF_PUTCHAR(buf, 'C');
 				}
-				break;
 			}
 
-			pixel++;
+			buf = putCell(buf, &line[col], &pen);
+			cursor = col + 1U;
 		}
-		BUF_PUTCHAR(buf, '\n');
+	}
+	return buf;
+}
+
+/* Exit on a write error. The writer thread only stops itself, and leaves the error for drawCells
+ * to raise on the game thread, which would otherwise go on drawing while exiting. */
+static void writeError(char *const format, const int err)
+{
+	if (!on_writer_thread)
+		I_Error(format, err);
+
+	frameLock();
+	writer_error_format = format;
+	writer_error = err;
+	writer_stopped = true;
+	frameSignal();
+	frameUnlock();
+#ifdef OS_WINDOWS
+	ExitThread(0);
+#else
+	pthread_exit(NULL);
+#endif
+}
+
+/* Write directly to stdout, bypassing stdio */
+static void writeOutput(const char *data, size_t len)
+{
+#ifdef OS_WINDOWS
+	if (UNLIKELY(fwrite(data, 1, len, stdout) != len))
+		writeError("writeOutput: fwrite error %d", errno);
+	if (UNLIKELY(fflush(stdout) == EOF))
+		writeError("writeOutput: fflush error %d", errno);
+#else
+	/* Anything printed through stdio must come first */
+	if (UNLIKELY(fflush(stdout) == EOF))
+		writeError("writeOutput: fflush error %d", errno);
+
+	while (len) {
+		const ssize_t n = write(STDOUT_FILENO, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct pollfd pfd = { .fd = STDOUT_FILENO, .events = POLLOUT };
+				(void)poll(&pfd, 1, -1);
+				continue;
+			}
+			writeError("writeOutput: write error %d", errno);
+		}
+		data += n;
+		len -= n;
+	}
+#endif
+}
+
+/* When writing to a TCP socket, hold back partial segments until the whole frame is written */
+static inline void corkOutput(const int cork)
+{
+#if !defined(OS_WINDOWS) && defined(TCP_CORK)
+	if (stdout_is_socket)
+		(void)setsockopt(STDOUT_FILENO, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+#else
+	(void)cork;
+#endif
+}
+
+/* Encode a frame and write it to stdout. In delta mode, the frame is swapped with prev_cells. */
+static void outputFrame(struct cell_t **const frame)
+{
+	char *buf = output_buffer;
+
+	/* Clear screen if first frame */
+	static bool first_frame = true;
+	if (first_frame) {
+		first_frame = false;
+		BUF_PUTS(buf, "\033[1;1H\033[2J");
+	}
+
+	/* fill output buffer */
+	BUF_PUTS(buf, "\033[;H"); /* move cursor to top left corner */
+	if (erase_enabled)
+		BUF_PUTS(buf, "\033[2J");
+	if (bold_enabled)
+		BUF_PUTS(buf, "\033[1m");
+	if (delta_enabled && frames_since_refresh && frames_since_refresh != refresh_frames) {
+		buf = encodeDelta(buf, *frame, prev_cells);
+		frames_since_refresh++;
+	} else {
+		buf = encodeFull(buf, *frame);
+		frames_since_refresh = 1;
 	}
 	if (color_enabled || bold_enabled)
 		BUF_PUTS(buf, "\033[0m");
-	BUF_PUTCHAR(buf, '\0');
 
-	CALL_STDOUT(fputs(output_buffer, stdout), "DG_DrawFrame: fputs error %d");
+	if (delta_enabled) {
+		struct cell_t *const tmp = prev_cells;
+		prev_cells = *frame;
+		*frame = tmp;
+	}
+
+	corkOutput(1);
+	writeOutput(output_buffer, buf - output_buffer);
+	corkOutput(0);
+}
+
+static void outputWindowTitle(const char *const title, const unsigned dropped)
+{
+	char buf[WINDOW_TITLE_LEN + 40];
+	const int len = dropped
+		? snprintf(buf, sizeof(buf), "\033]2;%.*s (%u frames dropped)\033\\",
+			  (int)WINDOW_TITLE_LEN - 1, title, dropped)
+		: snprintf(buf, sizeof(buf), "\033]2;%.*s\033\\", (int)WINDOW_TITLE_LEN - 1, title);
+	if (len > 0)
+		writeOutput(buf, len);
+}
+
+/* Writes the most recent frame passed on by DG_DrawFrame, so that the game never waits for the
+ * terminal. Frames which are replaced before the writer gets to them are dropped, and their number
+ * is shown in the window title, updated at most once a second. */
+static THREAD_FUNC(writerThread)
+{
+	(void)arg;
+	char title[WINDOW_TITLE_LEN] = "";
+	unsigned dropped_shown = 0;
+	uint64_t dropped_shown_us = 0;
+
+	on_writer_thread = true;
+
+	for (;;) {
+		frameLock();
+		while (!frame_ready && !window_title_ready && !writer_stop)
+			frameWait();
+
+		if (writer_stop) {
+			writer_stopped = true;
+			frameSignal();
+			frameUnlock();
+			return 0;
+		}
+
+		bool write_title = window_title_ready;
+		if (write_title) {
+			memcpy(title, window_title, WINDOW_TITLE_LEN);
+			window_title_ready = false;
+		}
+
+		const bool write_frame = frame_ready;
+		if (write_frame) {
+			struct cell_t *const tmp = write_cells;
+			write_cells = ready_cells;
+			ready_cells = tmp;
+			frame_ready = false;
+		}
+		const unsigned dropped = frames_dropped;
+		frameUnlock();
+
+		if (dropped != dropped_shown) {
+			const uint64_t now = DG_GetTicksUs();
+			if (now - dropped_shown_us >= 1000000) {
+				dropped_shown = dropped;
+				dropped_shown_us = now;
+				write_title = true;
+			}
+		}
+
+		if (write_title)
+			outputWindowTitle(title, dropped_shown);
+		if (write_frame)
+			outputFrame(&write_cells);
+	}
+	return 0;
+}
+
+/* Hand the frame in cells over for output */
+static void drawCells(void)
+{
+	if (!async_write_enabled) {
+		outputFrame(&cells);
+		return;
+	}
+
+	frameLock();
+	if (UNLIKELY(writer_error_format != NULL)) {
+		frameUnlock();
+		I_Error(writer_error_format, writer_error);
+	}
+	struct cell_t *const tmp = ready_cells;
+	ready_cells = cells;
+	cells = tmp;
+	if (frame_ready)
+		frames_dropped++;
+	frame_ready = true;
+	frameSignal();
+	frameUnlock();
+}
+
+static void checkDemo(void)
+{
+#ifdef DG_DEMO
+	struct timespec now;
+	CALL(clock_gettime(CLK, &now), "DG_DrawFrame: clock_gettime error %d");
+	if (sub_timespec_ms(&now, &ts_init) > DEMO_MAX_MS) {
+		puts("\033[;H\033[2JThe telnet demo of doom-ascii is limited to 10 minutes, as computational\nresources don't grow on trees. Thank you for playing!\n- Wojciech Graj <me@w-graj.net>");
+		exit(0);
+	}
+#endif /* DG_DEMO */
+}
+
+void DG_DrawFrame(void)
+{
+	checkDemo();
+	buildCells();
+	drawCells();
+}
+
+void DG_DrawIndexedFrame(const uint8_t *const frame, const unsigned pitch, const unsigned step)
+{
+	checkDemo();
+	buildIndexedCells(frame, pitch, step);
+	drawCells();
+}
+
+void DG_SetPalette(const uint32_t *const palette)
+{
+	unsigned i;
+
+	palette_braille_enabled = false;
+	for (i = 0; i < 256; i++) {
+		struct color_t pixel;
+		memcpy(&pixel, &palette[i], sizeof(pixel));
+		if (gamma_correct_enabled) {
+			pixel.r = byte_sqrt[pixel.r];
+			pixel.g = byte_sqrt[pixel.g];
+			pixel.b = byte_sqrt[pixel.b];
+		}
+
+		palette_braille[i] = makeCell(&palette_cells[i], pixel);
+		if (color_mode != TRUECOLOR)
+			palette_cells[i].color = nearestTermColor(pixel.r, pixel.g, pixel.b);
+		if (palette_braille[i])
+			palette_braille_enabled = true;
+	}
 }
 
 void DG_SleepMs(const uint32_t ms)
@@ -411,12 +1281,53 @@ void DG_SleepMs(const uint32_t ms)
 #endif
 }
 
-uint32_t DG_GetTicksMs(void)
+/* Sleeps until DG_GetTicksUs reaches us */
+void DG_SleepUntilUs(const uint64_t us)
+{
+#if defined(OS_WINDOWS) || defined(__APPLE__)
+	/* No clock_nanosleep, sleep for what is left instead, rounded up so as not to wake early */
+	const uint64_t now = DG_GetTicksUs();
+	if (us > now)
+		DG_SleepMs((us - now + 999) / 1000);
+#else
+	struct timespec ts = ts_init;
+	ts.tv_sec += us / 1000000;
+	ts.tv_nsec += (us % 1000000) * 1000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	while (clock_nanosleep(CLK, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+#endif
+}
+
+uint64_t DG_GetTicksUs(void)
 {
 	struct timespec ts;
-	CALL(clock_gettime(CLK, &ts), "DG_GetTickMs: clock_gettime error: %d");
+	CALL(clock_gettime(CLK, &ts), "DG_GetTicksUs: clock_gettime error: %d");
+
+	return (int64_t)(ts.tv_sec - ts_init.tv_sec) * 1000000 + (ts.tv_nsec - ts_init.tv_nsec) / 1000;
+}
+
+uint32_t DG_GetTicksMs(void)
+{
+	return DG_GetTicksUs() / 1000;
+}
 
-	return (ts.tv_sec - ts_init.tv_sec) * 1000 + (ts.tv_nsec - ts_init.tv_nsec) / 1000000;
+static void keyQueuePush(const unsigned char key, const struct timespec *const time)
+{
+	const unsigned tail = key_queue_tail;
+	if (tail - ATOMIC_LOAD(&key_queue_head) == KEY_QUEUE_LEN)
+		return; /* full, drop the key */
+	key_queue[tail & (KEY_QUEUE_LEN - 1U)] = (struct key_event_t){ .time = *time, .key = key };
+	ATOMIC_STORE(&key_queue_tail, tail + 1U);
+}
+
+static inline void keyHit(const unsigned char key, const struct timespec *const time)
+{
+	if (key)
+		keyQueuePush(key, time);
 }
 
 #ifdef OS_WINDOWS
@@ -511,18 +1422,78 @@ static inline unsigned char convertToDoomKey(const WORD wVirtualKeyCode, const C
 		return tolower(AsciiChar);
 	}
 }
+
+static void readInput(const struct timespec *const now)
+{
+	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
+	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, "DG_ReadInput: %s");
+
+	DWORD event_cnt;
+	WINDOWS_CALL(!GetNumberOfConsoleInputEvents(hInputHandle, &event_cnt), "DG_ReadInput: %s");
+
+	/* ReadConsole is blocking so must manually process events */
+	if (event_cnt) {
+		INPUT_RECORD input_records[32];
+		WINDOWS_CALL(!ReadConsoleInput(hInputHandle, input_records, 32, &event_cnt),
+			"DG_ReadInput: %s");
+
+		DWORD i;
+		for (i = 0; i < event_cnt; i++) {
+			if (input_records[i].Event.KeyEvent.bKeyDown
+				&& input_records[i].EventType == KEY_EVENT) {
+				unsigned char inp = convertToDoomKey(
+					input_records[i].Event.KeyEvent.wVirtualKeyCode,
+					input_records[i].Event.KeyEvent.uChar.AsciiChar);
+				keyHit(inp, now);
+			}
+		}
+	}
+}
+
+static THREAD_FUNC(inputThread)
+{
+	(void)arg;
+	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
+	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, "inputThread: %s");
+
+	for (;;) {
+		WINDOWS_CALL(WaitForSingleObject(hInputHandle, INFINITE) == WAIT_FAILED,
+			"inputThread: %s");
+
+		struct timespec now;
+		CALL(clock_gettime(CLK, &now), "inputThread: clock_gettime error %d");
+		readInput(&now);
+	}
+}
 #else
-static unsigned char doomKeyIfTilda(const char **const buf, const unsigned char key)
+static inline int inputPeek(const unsigned offset)
 {
-	if (*((*buf) + 1) != '~')
-		return '\0';
-	(*buf)++;
-	return key;
+	if (input_tail - input_head <= offset)
+		return -1;
+	return input_ring[(input_head + offset) & (INPUT_RING_LEN - 1U)];
 }
 
-static inline unsigned char convertCsiToDoomKey(const char **const buf)
+static void fillInputRing(void)
 {
-	switch (**buf) {
+	while (input_tail - input_head < INPUT_RING_LEN) {
+		const unsigned start = input_tail & (INPUT_RING_LEN - 1U);
+		const unsigned space = INPUT_RING_LEN - (input_tail - input_head);
+		const size_t len = space < INPUT_RING_LEN - start ? space : INPUT_RING_LEN - start;
+		const ssize_t n = read(STDIN_FILENO, &input_ring[start], len);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return;
+			I_Error("DG_ReadInput: read error %d", errno);
+		}
+		input_tail += n;
+		if ((size_t)n < len)
+			return;
+	}
+}
+
+static inline unsigned char convertCsiToDoomKey(const unsigned param, const int final)
+{
+	switch (final) {
 	case 'A':
 		return KEY_UPARROW;
 	case 'B':
@@ -535,57 +1506,45 @@ static inline unsigned char convertCsiToDoomKey(const char **const buf)
 		return KEY_HOME;
 	case 'F':
 		return KEY_END;
-	case '1':
-		switch (*((*buf) + 1)) {
-		case '5':
-			(*buf)++;
-			return doomKeyIfTilda(buf, KEY_F5);
-		case '7':
-			(*buf)++;
-			return doomKeyIfTilda(buf, KEY_F6);
-		case '8':
-			(*buf)++;
-			return doomKeyIfTilda(buf, KEY_F7);
-		case '9':
-			(*buf)++;
-			return doomKeyIfTilda(buf, KEY_F8);
-		default:
-			return '\0';
-		}
-	case '2':
-		switch (*((*buf) + 1)) {
-		case '0':
-			(*buf)++;
-			return doomKeyIfTilda(buf, KEY_F9);
-		case '1':
-			(*buf)++;
-			return doomKeyIfTilda(buf, KEY_F10);
-		case '3':
-			(*buf)++;
-			return doomKeyIfTilda(buf, KEY_F11);
-		case '4':
-			(*buf)++;
-			return doomKeyIfTilda(buf, KEY_F12);
-		case '~':
-			(*buf)++;
-			return KEY_INS;
-		default:
-			return '\0';
-		}
-	case '3':
-		return doomKeyIfTilda(buf, KEY_DEL);
-	case '5':
-		return doomKeyIfTilda(buf, KEY_PGUP);
-	case '6':
-		return doomKeyIfTilda(buf, KEY_PGDN);
+	case '~':
+		break;
+	default:
+		return '\0';
+	}
+
+	switch (param) {
+	case 2:
+		return KEY_INS;
+	case 3:
+		return KEY_DEL;
+	case 5:
+		return KEY_PGUP;
+	case 6:
+		return KEY_PGDN;
+	case 15:
+		return KEY_F5;
+	case 17:
+		return KEY_F6;
+	case 18:
+		return KEY_F7;
+	case 19:
+		return KEY_F8;
+	case 20:
+		return KEY_F9;
+	case 21:
+		return KEY_F10;
+	case 23:
+		return KEY_F11;
+	case 24:
+		return KEY_F12;
 	default:
 		return '\0';
 	}
 }
 
-static inline unsigned char convertSs3ToDoomKey(const char **const buf)
+static inline unsigned char convertSs3ToDoomKey(const int c)
 {
-	switch (**buf) {
+	switch (c) {
 	case 'P':
 		return KEY_F1;
 	case 'Q':
@@ -599,135 +1558,160 @@ static inline unsigned char convertSs3ToDoomKey(const char **const buf)
 	}
 }
 
-static inline unsigned char convertToDoomKey(const char **const buf)
+/* Decode the key at the start of the input ring. Returns the number of bytes it spans, or 0 if
+ * they are the start of an escape sequence which has not been read in full yet. */
+static unsigned convertToDoomKey(unsigned char *const key)
 {
-	switch (**buf) {
-	case '\012':
-		return KEY_ENTER;
-	case '\033':
-		switch (*((*buf) + 1)) {
-		case '[':
-			*buf += 2;
-			return convertCsiToDoomKey(buf);
-		case 'O':
-			*buf += 2;
-			return convertSs3ToDoomKey(buf);
-		default:
-			return KEY_ESCAPE;
-		}
-	default:
-		return tolower(**buf);
+	const int c = inputPeek(0);
+	if (c == '\012') {
+		*key = KEY_ENTER;
+		return 1;
+	}
+	if (c != '\033') {
+		*key = tolower(c);
+		return 1;
 	}
-}
-#endif
-
-void DG_ReadInput(void)
-{
-	struct timespec prev_input_buffer[256];
-	memcpy(prev_input_buffer, input_buffer, sizeof(struct timespec[256]));
-
-	struct timespec now;
-	CALL(clock_gettime(CLK, &now), "DG_ReadInput: clock_gettime error %d");
-#ifdef OS_WINDOWS
-	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
-	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, "DG_ReadInput: %s");
 
-	/* Disable canonical mode */
-	DWORD old_mode, new_mode;
-	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &old_mode), "DG_ReadInput: %s");
-	new_mode = old_mode;
-	new_mode &= ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT);
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, new_mode), "DG_ReadInput: %s");
+	int c1 = inputPeek(1);
+	switch (c1) {
+	case -1:
+		return 0;
+	case 'O':
+		c1 = inputPeek(2);
+		if (c1 < 0)
+			return 0;
+		*key = convertSs3ToDoomKey(c1);
+		return 3;
+	case '[':
+		break;
+	default:
+		*key = KEY_ESCAPE;
+		return 1;
+	}
 
-	DWORD event_cnt;
-	WINDOWS_CALL(!GetNumberOfConsoleInputEvents(hInputHandle, &event_cnt), "DG_ReadInput: %s");
+	/* CSI: parameter and intermediate bytes, terminated by a byte in the range 0x40-0x7E */
+	unsigned param = 0;
+	bool first_param = true;
+	unsigned i;
+	for (i = 2; i < CSI_MAX_LEN; i++) {
+		c1 = inputPeek(i);
+		if (c1 < 0)
+			return 0;
+		if (c1 >= 0x40 && c1 <= 0x7E) {
+			*key = convertCsiToDoomKey(param, c1);
+			return i + 1;
+		}
+		if (c1 == ';')
+			first_param = false;
+		else if (first_param && isdigit(c1))
+			param = param * 10 + (c1 - '0');
+	}
 
-	/* ReadConsole is blocking so must manually process events */
-	if (event_cnt) {
-		INPUT_RECORD input_records[32];
-		WINDOWS_CALL(!ReadConsoleInput(hInputHandle, input_records, 32, &event_cnt),
-			"DG_ReadInput: %s");
+	/* Malformed sequence */
+	*key = '\0';
+	return i;
+}
 
-		DWORD i;
-		for (i = 0; i < event_cnt; i++) {
-			if (input_records[i].Event.KeyEvent.bKeyDown
-				&& input_records[i].EventType == KEY_EVENT) {
-				unsigned char inp = convertToDoomKey(
-					input_records[i].Event.KeyEvent.wVirtualKeyCode,
-					input_records[i].Event.KeyEvent.uChar.AsciiChar);
-				input_buffer[inp] = now;
+static void readInput(const struct timespec *const now)
+{
+	fillInputRing();
+
+	while (input_head != input_tail) {
+		unsigned char inp;
+		unsigned len = convertToDoomKey(&inp);
+		if (!len) {
+			/* Wait for the rest of the sequence, unless nothing arrived since the last
+			 * read, in which case escape was pressed on its own */
+			if (!input_pending || input_pending_tail != input_tail) {
+				input_pending = true;
+				input_pending_tail = input_tail;
+				break;
 			}
+			inp = KEY_ESCAPE;
+			len = 1;
 		}
+		input_pending = false;
+		input_head += len;
+		keyHit(inp, now);
 	}
+}
 
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, old_mode), "DG_ReadInput: %s");
-#else /* defined(OS_WINDOWS) */
-	static char raw_input_buffer[INPUT_BUFFER_LEN];
-	struct termios oldt, newt;
-
-	memset(raw_input_buffer, '\0', INPUT_BUFFER_LEN);
-
-	/* Disable canonical mode */
-	CALL(tcgetattr(STDIN_FILENO, &oldt), "DG_DrawFrame: tcgetattr error %d");
-	newt = oldt;
-	newt.c_lflag &= ~(ICANON);
-	newt.c_cc[VMIN] = 0;
-	newt.c_cc[VTIME] = 0;
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &newt), "DG_DrawFrame: tcsetattr error %d");
-
-	CALL(read(2, raw_input_buffer, INPUT_BUFFER_LEN - 1U) < 0, "DG_DrawFrame: read error %d");
-
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &oldt), "DG_DrawFrame: tcsetattr error %d");
-
-	/* Flush input buffer to prevent read of previous unread input */
-	CALL(tcflush(STDIN_FILENO, TCIFLUSH), "DG_DrawFrame: tcflush error %d");
+static THREAD_FUNC(inputThread)
+{
+	(void)arg;
+	struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+
+	for (;;) {
+		/* Only time out to resolve a lone escape */
+		if (poll(&pfd, 1, input_pending ? (int)ESC_TIMEOUT_MS : -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			I_Error("inputThread: poll error %d", errno);
+		}
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+			break;
 
-	/* create input buffer */
-	const char *raw_input_buf_loc = raw_input_buffer;
-	while (*raw_input_buf_loc) {
-		const unsigned char inp = convertToDoomKey(&raw_input_buf_loc);
-		input_buffer[inp] = now;
-		raw_input_buf_loc++;
+		struct timespec now;
+		CALL(clock_gettime(CLK, &now), "inputThread: clock_gettime error %d");
+		readInput(&now);
 	}
+	return 0;
+}
 #endif
-	memset(event_buffer, '\0', sizeof(struct event_buffer_t[EVENT_BUFFER_LEN]));
-	event_buf_loc = event_buffer;
-
-	int i;
-	for (i = 1; i < 256; i++) {
-		if (!memcmp(&input_buffer[i], &(struct timespec){ 0 }, sizeof(struct timespec)))
-			continue;
-
-		/* depressed events */
-		if (sub_timespec_ms(&now, &input_buffer[i]) > keypress_smoothing_ms) {
-			input_buffer[i] = (struct timespec){ 0 };
-			*event_buf_loc++ = (struct event_buffer_t){ .key = i };
-			continue;
-		}
 
-		/* pressed events */
-		if (!memcmp(&prev_input_buffer[i], &(struct timespec){ 0 },
-			    sizeof(struct timespec)))
-			*event_buf_loc++ = (struct event_buffer_t){ .key = i, .pressed = true };
-	}
+void DG_ReadInput(void)
+{
+	CALL(clock_gettime(CLK, &input_time), "DG_ReadInput: clock_gettime error %d");
 
-	event_buf_loc = event_buffer;
+	if (!input_thread_enabled)
+		readInput(&input_time);
 }
 
+/* Pops the keys hit since the last call off key_queue, then releases the held keys which have not
+ * been hit for keypress_smoothing_ms */
 int DG_GetKey(int *const pressed, unsigned char *const doomKey)
 {
-	if (!event_buf_loc->key)
-		return 0;
+	const unsigned tail = ATOMIC_LOAD(&key_queue_tail);
+	while (key_queue_head != tail) {
+		const struct key_event_t *const event = &key_queue[key_queue_head & (KEY_QUEUE_LEN - 1U)];
+		const unsigned char key = event->key;
+		key_hit_time[key] = event->time;
+		ATOMIC_STORE(&key_queue_head, key_queue_head + 1U);
+
+		/* Hitting a held key again only keeps it held */
+		if (!key_held[key]) {
+			key_held[key] = true;
+			held_keys[n_held_keys++] = key;
+			*pressed = 1;
+			*doomKey = key;
+			return 1;
+		}
+	}
 
-	*pressed = event_buf_loc->pressed;
-	*doomKey = event_buf_loc->key;
-	event_buf_loc++;
-	return 1;
+	unsigned i;
+	for (i = 0; i < n_held_keys; i++) {
+		const unsigned char key = held_keys[i];
+		if (sub_timespec_ms(&input_time, &key_hit_time[key]) > keypress_smoothing_ms) {
+			key_held[key] = false;
+			held_keys[i] = held_keys[--n_held_keys];
+			*pressed = 0;
+			*doomKey = key;
+			return 1;
+		}
+	}
+	return 0;
 }
 
 void DG_SetWindowTitle(const char *const title)
 {
-	CALL_STDOUT(fputs("\033]2;", stdout), "DG_SetWindowTitle: fputs error %d");
-	CALL_STDOUT(fputs(title, stdout), "DG_SetWindowTitle: fputs error %d");
-	CALL_STDOUT(fputs("\033\\", stdout), "DG_SetWindowTitle: fputs error %d");
+	if (!async_write_enabled) {
+		outputWindowTitle(title, 0);
+		return;
+	}
+
+	frameLock();
+	(void)snprintf(window_title, WINDOW_TITLE_LEN, "%s", title);
+	window_title_ready = true;
+	frameSignal();
+	frameUnlock();
 }
@@ -27,6 +27,7 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #else
+#include <sys/mman.h>
 #include <unistd.h>
 #endif
 
@@ -163,6 +164,45 @@ byte *I_ZoneBase (int *size)
     return zonemem;
 }
 
+//
+// Memory for another region of a full zone, see -zgrow.
+//
+
+byte *I_ZoneRegion (int size)
+{
+    byte *mem;
+
+    mem = malloc(size);
+
+    if (mem == NULL)
+    {
+        I_Error("Unable to allocate %i KiB more for zone", size / 1024);
+    }
+
+    return mem;
+}
+
+//
+// Give the pages of an unused part of the zone back to the OS.
+// What was in them is lost.
+//
+
+void I_ZoneDiscard (byte *ptr, int size)
+{
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+    uintptr_t pagesize, start, end;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    start = ((uintptr_t) ptr + pagesize - 1) & ~(pagesize - 1);
+    end = ((uintptr_t) ptr + size) & ~(pagesize - 1);
+
+    if (end > start)
+    {
+        madvise((void *) start, end - start, MADV_DONTNEED);
+    }
+#endif
+}
+
 void I_PrintBanner(char *msg)
 {
     int i;
@@ -34,6 +34,11 @@ void I_Init (void);
 // for the zone management.
 byte*	I_ZoneBase (int *size);
 
+// Called when the zone is full and may grow,
+// and when a region of it is no longer used.
+byte*	I_ZoneRegion (int size);
+void	I_ZoneDiscard (byte *ptr, int size);
+
 bool I_ConsoleStdout(void);
 
 
@@ -0,0 +1,220 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Worker thread pool.
+//	The calling thread takes part in every batch of calls,
+//	 so a pool of one thread runs everything inline.
+//
+
+
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "i_system.h"
+#include "i_thread.h"
+
+
+#ifdef _WIN32
+
+typedef CRITICAL_SECTION	mutex_t;
+typedef CONDITION_VARIABLE	cond_t;
+
+static void MutexInit (mutex_t *m) { InitializeCriticalSection(m); }
+static void MutexLock (mutex_t *m) { EnterCriticalSection(m); }
+static void MutexUnlock (mutex_t *m) { LeaveCriticalSection(m); }
+static void CondInit (cond_t *c) { InitializeConditionVariable(c); }
+static void CondWait (cond_t *c, mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void CondBroadcast (cond_t *c) { WakeAllConditionVariable(c); }
+
+#else
+
+typedef pthread_mutex_t		mutex_t;
+typedef pthread_cond_t		cond_t;
+
+static void MutexInit (mutex_t *m) { pthread_mutex_init(m, NULL); }
+static void MutexLock (mutex_t *m) { pthread_mutex_lock(m); }
+static void MutexUnlock (mutex_t *m) { pthread_mutex_unlock(m); }
+static void CondInit (cond_t *c) { pthread_cond_init(c, NULL); }
+static void CondWait (cond_t *c, mutex_t *m) { pthread_cond_wait(c, m); }
+static void CondBroadcast (cond_t *c) { pthread_cond_broadcast(c); }
+
+#endif
+
+
+static int		numthreads = 1;
+
+// Guards everything below.
+static mutex_t		poollock;
+static cond_t		startcond;
+static cond_t		donecond;
+
+// Bumped for every batch, wakes the workers.
+static unsigned		generation;
+
+static threadfunc_t	jobfunc;
+static void*		jobarg;
+static int		jobcount;
+static int		nextjob;
+static int		jobsleft;
+
+// Lock for the callers, see I_LockThreads.
+static mutex_t		userlock;
+
+
+//
+// RunJobs
+// Takes calls from the current batch until none are left.
+// Must be called with poollock held.
+//
+static void RunJobs (void)
+{
+    threadfunc_t	func;
+    void*		arg;
+    int			index;
+
+    while (nextjob < jobcount)
+    {
+	index = nextjob++;
+	func = jobfunc;
+	arg = jobarg;
+
+	MutexUnlock(&poollock);
+	func(arg, index);
+	MutexLock(&poollock);
+
+	if (--jobsleft == 0)
+	    CondBroadcast(&donecond);
+    }
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI WorkerThread (LPVOID unused)
+#else
+static void *WorkerThread (void *unused)
+#endif
+{
+    unsigned	seen;
+
+    MutexLock(&poollock);
+    seen = generation;
+
+    for (;;)
+    {
+	while (generation == seen)
+	    CondWait(&startcond, &poollock);
+
+	seen = generation;
+	RunJobs();
+    }
+
+    return 0;
+}
+
+
+//
+// I_InitThreads
+//
+void I_InitThreads (int count)
+{
+    int		i;
+
+    if (numthreads > 1 || count <= 1)
+	return;
+
+    MutexInit(&poollock);
+    MutexInit(&userlock);
+    CondInit(&startcond);
+    CondInit(&donecond);
+
+    for (i=1 ; i<count ; i++)
+    {
+#ifdef _WIN32
+	HANDLE	thread;
+
+	thread = CreateThread(NULL, 0, WorkerThread, NULL, 0, NULL);
+	if (thread == NULL)
+	    I_Error("I_InitThreads: CreateThread failed (%lu)", GetLastError());
+	CloseHandle(thread);
+#else
+	pthread_t	thread;
+	int		err;
+
+	err = pthread_create(&thread, NULL, WorkerThread, NULL);
+	if (err)
+	    I_Error("I_InitThreads: pthread_create failed (%i)", err);
+	pthread_detach(thread);
+#endif
+    }
+
+    numthreads = count;
+}
+
+
+int I_NumThreads (void)
+{
+    return numthreads;
+}
+
+
+//
+// I_RunThreads
+//
+void I_RunThreads (threadfunc_t func, void *arg, int count)
+{
+    int		i;
+
+    if (numthreads <= 1 || count <= 1)
+    {
+	for (i=0 ; i<count ; i++)
+	    func(arg, i);
+	return;
+    }
+
+    MutexLock(&poollock);
+
+    jobfunc = func;
+    jobarg = arg;
+    jobcount = count;
+    nextjob = 0;
+    jobsleft = count;
+    generation++;
+    CondBroadcast(&startcond);
+
+    RunJobs();
+
+    while (jobsleft > 0)
+	CondWait(&donecond, &poollock);
+
+    MutexUnlock(&poollock);
+}
+
+
+void I_LockThreads (void)
+{
+    if (numthreads > 1)
+	MutexLock(&userlock);
+}
+
+
+void I_UnlockThreads (void)
+{
+    if (numthreads > 1)
+	MutexUnlock(&userlock);
+}
@@ -0,0 +1,44 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Worker thread pool.
+//
+
+
+#ifndef __I_THREAD__
+#define __I_THREAD__
+
+// Storage class for variables that get one copy per thread.
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+typedef void (*threadfunc_t) (void *arg, int index);
+
+// Start the pool with count threads, including the calling one.
+void I_InitThreads (int count);
+
+// Number of threads in the pool, including the calling one.
+int I_NumThreads (void);
+
+// Call func(arg, i) for every i in [0, count), spread over the pool.
+// Returns once all calls have finished.
+void I_RunThreads (threadfunc_t func, void *arg, int count);
+
+// Serialize access to data shared between the calls of I_RunThreads.
+void I_LockThreads (void);
+void I_UnlockThreads (void);
+
+#endif
@@ -31,7 +31,11 @@
 // returns time in 1/35th second tics
 //
 
-static uint32_t basetime = 0;
+// Microseconds since the first call, so that
+// tics start at a known point.
+
+static uint64_t basetime;
+static bool basetimeset = false;
 
 
 int I_GetTicks(void)
@@ -39,18 +43,28 @@ int I_GetTicks(void)
 	return DG_GetTicksMs();
 }
 
-int  I_GetTime (void)
+//
+// Same as I_GetTime, but returns time in microseconds
+//
+
+uint64_t I_GetTimeUS(void)
 {
-    uint32_t ticks;
+    uint64_t ticks;
 
-    ticks = I_GetTicks();
+    ticks = DG_GetTicksUs();
 
-    if (basetime == 0)
+    if (!basetimeset)
+    {
         basetime = ticks;
+        basetimeset = true;
+    }
 
-    ticks -= basetime;
+    return ticks - basetime;
+}
 
-    return (ticks * TICRATE) / 1000;    
+int  I_GetTime (void)
+{
+    return (I_GetTimeUS() * TICRATE) / 1000000;
 }
 
 
@@ -60,14 +74,7 @@ int  I_GetTime (void)
 
 int I_GetTimeMS(void)
 {
-    uint32_t ticks;
-
-    ticks = I_GetTicks();
-
-    if (basetime == 0)
-        basetime = ticks;
-
-    return ticks - basetime;
+    return I_GetTimeUS() / 1000;
 }
 
 // Sleep for a specified number of ms
@@ -80,6 +87,30 @@ void I_Sleep(int ms)
 	DG_SleepMs(ms);
 }
 
+//
+// Sleep until I_GetTimeUS reaches the given time.
+// The deadline is absolute, so time spent before
+// sleeping does not add up.
+//
+
+void I_SleepUntilUS(uint64_t us)
+{
+    // make sure the base is set
+    I_GetTimeUS();
+
+    DG_SleepUntilUs(basetime + us);
+}
+
+//
+// Same, until I_GetTime reaches the given tic.
+//
+
+void I_SleepUntilTic(int tic)
+{
+    // first us of the tic
+    I_SleepUntilUS(((uint64_t) tic * 1000000 + TICRATE - 1) / TICRATE);
+}
+
 void I_WaitVBL(int count)
 {
     //I_Sleep((count * 1000) / 70);
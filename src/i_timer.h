@@ -20,6 +20,8 @@
 #ifndef __I_TIMER__
 #define __I_TIMER__
 
+#include "doomtype.h"
+
 #define TICRATE 35
 
 // Called by D_DoomLoop,
@@ -29,9 +31,16 @@ int I_GetTime (void);
 // returns current time in ms
 int I_GetTimeMS (void);
 
+// returns current time in us, for timing within a tic
+uint64_t I_GetTimeUS (void);
+
 // Pause for a specified number of ms
 void I_Sleep(int ms);
 
+// Pause until the given time in us or tics
+void I_SleepUntilUS(uint64_t us);
+void I_SleepUntilTic(int tic);
+
 // Initialize timer
 void I_InitTimer(void);
 
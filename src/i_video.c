@@ -47,8 +47,20 @@ rcsid[] = "$Id: i_x.c,v 1.6 1997/02/03 22:45:10 b1 Exp $";
 
 #include <sys/types.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BOX_SIMD
+#define BOX_ALIGN __attribute__((aligned(32)))
+#include <immintrin.h>
+#else
+#define BOX_ALIGN
+#endif
+
 //#define CMAP256
 
+// Largest scaling factor for which a block sum fits in 16 bits
+
+#define BOX_MAX_SCALING 16
+
 struct FB_BitField
 {
 	uint32_t offset;			/* beginning of bitfield	*/
@@ -84,6 +96,22 @@ struct color {
 
 static struct color colors[256];
 
+// Average each fb_scaling x fb_scaling block instead of taking its top left pixel
+
+static bool box_filter;
+
+// Palette with each channel widened to 16 bits, so that all four channels
+// of a pixel can be summed with a single 64-bit addition
+
+static uint64_t box_palette[256] BOX_ALIGN;
+
+// Per-channel sums of the current block row, 4 lanes (B, G, R, A) per column
+
+static uint64_t box_sums[SCREENWIDTH] BOX_ALIGN;
+
+static void (*box_accumulate)(const byte *in);
+static void (*box_reduce)(uint32_t *out, int out_pixels);
+
 void I_GetEvent(void);
 
 // The screen buffer; this is modified to draw things to the screen
@@ -126,28 +154,152 @@ typedef struct
 
 static uint16_t rgb565_palette[256];
 
-void cmap_to_fb(uint8_t * out, uint8_t * in, int in_pixels)
+//
+// Box filter kernels
+//
+// box_accumulate adds a row of palette-expanded pixels to box_sums, and
+// box_reduce divides the sums of each block by its area. The division is done
+// as a 16-bit fixed point multiply so that all kernels produce identical output.
+//
+
+static uint16_t box_magic(void)
+{
+	const int area = fb_scaling * fb_scaling;
+	return (65535 + area) / area;
+}
+
+static void box_set_palette(void)
 {
-    int i, j;
-    struct color c;
-    uint32_t pix;
-    uint16_t r, g, b;
+	int i;
 
-    for (i = 0; i < in_pixels; i += fb_scaling, in += fb_scaling)
-    {
-        c = colors[*in];  /* R:8 G:8 B:8 format! */
-        r = (uint16_t)(c.r >> (8 - s_Fb.red.length));
-        g = (uint16_t)(c.g >> (8 - s_Fb.green.length));
-        b = (uint16_t)(c.b >> (8 - s_Fb.blue.length));
-        pix = r << s_Fb.red.offset;
-        pix |= g << s_Fb.green.offset;
-        pix |= b << s_Fb.blue.offset;
-
-		for (j = 0; j < s_Fb.bits_per_pixel/8; j++) {
-			*out = (pix >> (j*8));
-			out++;
-		}
-    }
+	for (i = 0; i < 256; i++)
+	{
+		box_palette[i] = (uint64_t)colors[i].b
+		               | (uint64_t)colors[i].g << 16
+		               | (uint64_t)colors[i].r << 32
+		               | (uint64_t)colors[i].a << 48;
+	}
+}
+
+static void box_accumulate_scalar(const byte *in)
+{
+	int i;
+
+	for (i = 0; i < SCREENWIDTH; i++)
+		box_sums[i] += box_palette[in[i]];
+}
+
+static void box_reduce_scalar(uint32_t *out, int out_pixels)
+{
+	const uint64_t *sum = box_sums;
+	const uint32_t magic = box_magic();
+	const uint64_t half = (fb_scaling * fb_scaling / 2) * 0x0001000100010001ull;
+	uint64_t acc;
+	int i, j, k;
+
+	for (i = 0; i < out_pixels; i++)
+	{
+		acc = half;
+		for (j = 0; j < fb_scaling; j++)
+			acc += *sum++;
+
+		out[i] = 0;
+		for (k = 0; k < 4; k++)
+			out[i] |= (((acc >> (k * 16) & 0xffff) * magic) >> 16) << (k * 8);
+	}
+}
+
+#ifdef BOX_SIMD
+
+__attribute__((target("sse2")))
+static void box_accumulate_sse2(const byte *in)
+{
+	__m128i *sum = (__m128i *)box_sums;
+	__m128i px;
+	int i;
+
+	for (i = 0; i < SCREENWIDTH; i += 2, sum++)
+	{
+		px = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)&box_palette[in[i]]),
+		                        _mm_loadl_epi64((const __m128i *)&box_palette[in[i + 1]]));
+		*sum = _mm_add_epi16(*sum, px);
+	}
+}
+
+__attribute__((target("sse2")))
+static void box_reduce_sse2(uint32_t *out, int out_pixels)
+{
+	const uint64_t *sum = box_sums;
+	const __m128i magic = _mm_set1_epi16(box_magic());
+	const __m128i half = _mm_set1_epi16(fb_scaling * fb_scaling / 2);
+	__m128i acc;
+	int i, j;
+
+	for (i = 0; i < out_pixels; i++)
+	{
+		acc = _mm_setzero_si128();
+		for (j = 0; j + 1 < fb_scaling; j += 2, sum += 2)
+			acc = _mm_add_epi16(acc, _mm_loadu_si128((const __m128i *)sum));
+		if (j < fb_scaling)
+			acc = _mm_add_epi16(acc, _mm_loadl_epi64((const __m128i *)sum++));
+		acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
+		acc = _mm_add_epi16(acc, half);
+		acc = _mm_mulhi_epu16(acc, magic);
+		out[i] = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+	}
+}
+
+__attribute__((target("avx2")))
+static void box_accumulate_avx2(const byte *in)
+{
+	__m256i *sum = (__m256i *)box_sums;
+	__m256i px;
+	__m128i idx;
+	int i;
+
+	for (i = 0; i < SCREENWIDTH; i += 4, sum++)
+	{
+		idx = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int *)&in[i]));
+		px = _mm256_i32gather_epi64((const long long *)box_palette, idx, 8);
+		*sum = _mm256_add_epi16(*sum, px);
+	}
+}
+
+#endif
+
+static void box_init(void)
+{
+	box_set_palette();
+
+	box_accumulate = box_accumulate_scalar;
+	box_reduce = box_reduce_scalar;
+
+#ifdef BOX_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		box_accumulate = box_accumulate_sse2;
+		box_reduce = box_reduce_sse2;
+	}
+	// bench/boxfilter.c: the gather is as fast as SSE2 at scaling 2, and
+	// faster at 4 and 8, where most of the time goes into accumulating
+	if (__builtin_cpu_supports("avx2"))
+		box_accumulate = box_accumulate_avx2;
+#endif
+}
+
+// Averages fb_scaling rows of in into one row of out
+
+static void cmap_to_fb_box(uint32_t *out, const byte *in, int out_pixels)
+{
+	int y;
+
+	memset(box_sums, 0, sizeof(box_sums));
+
+	for (y = 0; y < fb_scaling; y++, in += SCREENWIDTH)
+		box_accumulate(in);
+
+	box_reduce(out, out_pixels);
 }
 
 void I_InitGraphics (void)
@@ -181,6 +333,16 @@ void I_InitGraphics (void)
 
 	printf("I_InitGraphics: Scaling factor: %d\n", fb_scaling);
 
+	//!
+	// Average each block of pixels when scaling the screen down,
+	// instead of only using its top left pixel.
+	//
+
+	box_filter = M_CheckParm("-boxfilter") > 0
+		&& fb_scaling > 1 && fb_scaling <= BOX_MAX_SCALING;
+	if (box_filter)
+		box_init();
+
     /* Allocate screen to draw to */
 	I_VideoBuffer = (byte*)Z_Malloc (SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);  // For DOOM to draw on
 
@@ -218,6 +380,12 @@ void I_FinishUpdate (void)
     int y;
     unsigned char *line_in, *line_out;
 
+    if (!box_filter)
+    {
+        DG_DrawIndexedFrame(I_VideoBuffer, SCREENWIDTH, fb_scaling);
+        return;
+    }
+
     /* DRAW SCREEN */
     line_in  = (unsigned char *) I_VideoBuffer;
     line_out = (unsigned char *) DG_ScreenBuffer;
@@ -226,7 +394,7 @@ void I_FinishUpdate (void)
 
     while (y--)
     {
-		cmap_to_fb((void*)line_out, (void*)line_in, SCREENWIDTH);
+		cmap_to_fb_box((void*)line_out, (void*)line_in, s_Fb.xres);
 		line_out += (SCREENWIDTH / fb_scaling * (s_Fb.bits_per_pixel/8));
         line_in += SCREENWIDTH * fb_scaling;
     }
@@ -253,6 +421,7 @@ void I_ReadScreen (byte* scr)
 void I_SetPalette (byte* palette)
 {
 	int i;
+	uint32_t dg_palette[256];
 	//col_t* c;
 
 	//for (i = 0; i < 256; i++)
@@ -276,6 +445,13 @@ void I_SetPalette (byte* palette)
         colors[i].g = gammatable[usegamma][*palette++];
         colors[i].b = gammatable[usegamma][*palette++];
     }
+
+    if (box_filter)
+        box_set_palette();
+
+    for (i = 0; i < 256; i++)
+        dg_palette[i] = colors[i].r << 16 | colors[i].g << 8 | colors[i].b;
+    DG_SetPalette(dg_palette);
 }
 
 // Given an RGB value, find the closest matching palette index.
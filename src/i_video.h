@@ -147,6 +147,7 @@ extern int vanilla_keyboard_mapping;
 extern bool screensaver_mode;
 extern int usegamma;
 extern byte *I_VideoBuffer;
+extern int fb_scaling;
 
 extern int screen_width;
 extern int screen_height;
@@ -835,6 +835,8 @@ P_SetupLevel
     if (precache)
 	R_PrecacheLevel ();
 
+    R_ClearLastView ();
+
     //printf ("free memory: 0x%x\n", Z_FreeMemory());
 
 }
@@ -29,6 +29,7 @@ int	leveltime;
 //
 // THINKERS
 // All thinkers should be allocated by Z_Malloc
+// or Z_MallocSlab
 // so they can be operated on uniformly.
 // The actual structures will vary in size,
 // but the first element must be thinker_t.
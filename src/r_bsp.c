@@ -19,6 +19,8 @@
 
 
 
+#include <stdlib.h>
+
 #include "doomdef.h"
 
 #include "m_bbox.h"
@@ -37,14 +39,15 @@
 
 
 
-seg_t*		curline;
-side_t*		sidedef;
-line_t*		linedef;
-sector_t*	frontsector;
-sector_t*	backsector;
+THREAD_LOCAL seg_t*		curline;
+THREAD_LOCAL side_t*		sidedef;
+THREAD_LOCAL line_t*		linedef;
+THREAD_LOCAL sector_t*	frontsector;
+THREAD_LOCAL sector_t*	backsector;
 
-drawseg_t	drawsegs[MAXDRAWSEGS];
-drawseg_t*	ds_p;
+THREAD_LOCAL drawseg_t*	drawsegs;
+THREAD_LOCAL drawseg_t*	ds_p;
+static THREAD_LOCAL int	maxdrawsegs;
 
 
 void
@@ -64,6 +67,28 @@ void R_ClearDrawSegs (void)
 }
 
 
+//
+// R_CheckDrawSegs
+// Makes room for one more drawseg.
+//
+void R_CheckDrawSegs (void)
+{
+    int		count;
+
+    count = ds_p - drawsegs;
+
+    if (count < maxdrawsegs)
+	return;
+
+    maxdrawsegs = maxdrawsegs ? maxdrawsegs*2 : MAXDRAWSEGS;
+    drawsegs = realloc (drawsegs, maxdrawsegs * sizeof(*drawsegs));
+    if (!drawsegs)
+	I_Error ("R_CheckDrawSegs: out of memory (%i drawsegs)", maxdrawsegs);
+
+    ds_p = drawsegs + count;
+}
+
+
 
 //
 // ClipWallSegment
@@ -81,8 +106,8 @@ typedef	struct
 #define MAXSEGS		32
 
 // newend is one past the last valid seg
-cliprange_t*	newend;
-cliprange_t	solidsegs[MAXSEGS];
+THREAD_LOCAL cliprange_t*	newend;
+THREAD_LOCAL cliprange_t	solidsegs[MAXSEGS];
 
 
 
@@ -527,6 +552,9 @@ void R_Subsector (int num)
 		
     R_AddSprites (frontsector);	
 
+    if (reuseview)
+	R_MarkViewSubsector (num);
+
     while (count--)
     {
 	R_AddLine (line);
@@ -20,27 +20,29 @@
 #ifndef __R_BSP__
 #define __R_BSP__
 
+#include "i_thread.h"
 
 
-extern seg_t*		curline;
-extern side_t*		sidedef;
-extern line_t*		linedef;
-extern sector_t*	frontsector;
-extern sector_t*	backsector;
 
-extern int		rw_x;
-extern int		rw_stopx;
+extern THREAD_LOCAL seg_t*		curline;
+extern THREAD_LOCAL side_t*		sidedef;
+extern THREAD_LOCAL line_t*		linedef;
+extern THREAD_LOCAL sector_t*	frontsector;
+extern THREAD_LOCAL sector_t*	backsector;
 
-extern bool		segtextured;
+extern THREAD_LOCAL int		rw_x;
+extern THREAD_LOCAL int		rw_stopx;
+
+extern THREAD_LOCAL bool		segtextured;
 
 // false if the back side is the same plane
-extern bool		markfloor;		
-extern bool		markceiling;
+extern THREAD_LOCAL bool		markfloor;		
+extern THREAD_LOCAL bool		markceiling;
 
 extern bool		skymap;
 
-extern drawseg_t	drawsegs[MAXDRAWSEGS];
-extern drawseg_t*	ds_p;
+extern THREAD_LOCAL drawseg_t*	drawsegs;
+extern THREAD_LOCAL drawseg_t*	ds_p;
 
 extern lighttable_t**	hscalelight;
 extern lighttable_t**	vscalelight;
@@ -53,6 +55,7 @@ typedef void (*drawfunc_t) (int start, int stop);
 // BSP?
 void R_ClearClipSegs (void);
 void R_ClearDrawSegs (void);
+void R_CheckDrawSegs (void);
 
 
 void R_RenderBSPNode (int bspnum);
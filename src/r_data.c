@@ -18,10 +18,12 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "deh_main.h"
 #include "i_swap.h"
 #include "i_system.h"
+#include "i_thread.h"
 #include "z_zone.h"
 
 
@@ -177,6 +179,55 @@ lighttable_t	*colormaps;
 
 
 
+//
+// CACHE PINNING
+// While the view is rendered in strips on several threads (-rthreads),
+//  an allocation on one thread could purge a patch, flat or composite
+//  another thread is drawing from.
+// With -deferdraw, the columns are drawn only after the data for
+//  the rest of the frame has been loaded.
+// Every lump and composite touched then stays PU_STATIC
+//  until R_UnpinCache at the end of the frame.
+//
+bool		pincache;
+
+static int	pinframe;
+static int*	lumppinframe;
+static int*	pinnedlumps;
+static int	numpinnedlumps;
+static int*	texturepinframe;
+static int*	pinnedtextures;
+static int	numpinnedtextures;
+
+// What the current thread has already pinned this frame,
+//  so that it only takes the lock once per lump or texture.
+static THREAD_LOCAL int*	threadlumpframe;
+static THREAD_LOCAL void**	threadlumps;
+static THREAD_LOCAL int*	threadtextureframe;
+static THREAD_LOCAL byte**	threadtextures;
+
+
+//
+// R_PinLump
+// Must be called with the thread lock held.
+//
+static void *R_PinLump (int lump)
+{
+    void*	data;
+
+    data = W_CacheLumpNum (lump, PU_STATIC);
+
+    if (lumppinframe[lump] != pinframe)
+    {
+	lumppinframe[lump] = pinframe;
+	pinnedlumps[numpinnedlumps++] = lump;
+    }
+
+    return data;
+}
+
+
+
 //
 // R_DrawColumnInCache
 // Clip and draw a column
@@ -218,14 +269,12 @@ R_DrawColumnInCache
 
 
 //
-// R_GenerateComposite
-// Using the texture definition,
-//  the composite texture is created from the patches,
-//  and each column is cached.
+// R_ComposeColumns
+// Draws the columns covered by more than one patch
+//  into block, at the offsets set by R_GenerateLookup.
 //
-void R_GenerateComposite (int texnum)
+static void R_ComposeColumns (int texnum, byte *block)
 {
-    byte*		block;
     texture_t*		texture;
     texpatch_t*		patch;
     patch_t*		realpatch;
@@ -239,10 +288,6 @@ void R_GenerateComposite (int texnum)
 
     texture = textures[texnum];
 
-    block = Z_Malloc (texturecompositesize[texnum],
-		      PU_STATIC,
-		      &texturecomposite[texnum]);
-
     collump = texturecolumnlump[texnum];
     colofs = texturecolumnofs[texnum];
 
@@ -253,7 +298,10 @@ void R_GenerateComposite (int texnum)
 	 i<texture->patchcount;
 	 i++, patch++)
     {
-	realpatch = W_CacheLumpNum (patch->patch, PU_CACHE);
+	if (pincache)
+	    realpatch = R_PinLump (patch->patch);
+	else
+	    realpatch = W_CacheLumpNum (patch->patch, PU_CACHE);
 	x1 = patch->originx;
 	x2 = x1 + SHORT(realpatch->width);
 
@@ -280,6 +328,24 @@ void R_GenerateComposite (int texnum)
 	}
 
     }
+}
+
+
+//
+// R_GenerateComposite
+// Using the texture definition,
+//  the composite texture is created from the patches,
+//  and each column is cached.
+//
+void R_GenerateComposite (int texnum)
+{
+    byte*		block;
+
+    block = Z_Malloc (texturecompositesize[texnum],
+		      PU_STATIC,
+		      &texturecomposite[texnum]);
+
+    R_ComposeColumns (texnum, block);
 
     // Now that the texture has been built in column cache,
     //  it is purgable from zone memory.
@@ -376,6 +442,465 @@ void R_GenerateLookup (int texnum)
 
 
 
+//
+// R_PinCache
+// Called before rendering a frame.
+//
+void R_PinCache (void)
+{
+    if (!lumppinframe)
+    {
+	lumppinframe = Z_Malloc (numlumps * sizeof(*lumppinframe), PU_STATIC, 0);
+	pinnedlumps = Z_Malloc (numlumps * sizeof(*pinnedlumps), PU_STATIC, 0);
+	texturepinframe = Z_Malloc (numtextures * sizeof(*texturepinframe), PU_STATIC, 0);
+	pinnedtextures = Z_Malloc (numtextures * sizeof(*pinnedtextures), PU_STATIC, 0);
+	memset (lumppinframe, 0, numlumps * sizeof(*lumppinframe));
+	memset (texturepinframe, 0, numtextures * sizeof(*texturepinframe));
+    }
+
+    pinframe++;
+    pincache = true;
+}
+
+
+//
+// R_UnpinCache
+// Called once the frame is drawn, makes everything purgable again.
+//
+void R_UnpinCache (void)
+{
+    int		i;
+
+    for (i=0 ; i<numpinnedlumps ; i++)
+	W_ReleaseLumpNum (pinnedlumps[i]);
+
+    for (i=0 ; i<numpinnedtextures ; i++)
+	Z_ChangeTag (texturecomposite[pinnedtextures[i]], PU_CACHE);
+
+    numpinnedlumps = 0;
+    numpinnedtextures = 0;
+    pincache = false;
+}
+
+
+static void R_InitThreadPins (void)
+{
+    threadlumpframe = calloc (numlumps, sizeof(*threadlumpframe));
+    threadlumps = calloc (numlumps, sizeof(*threadlumps));
+    threadtextureframe = calloc (numtextures, sizeof(*threadtextureframe));
+    threadtextures = calloc (numtextures, sizeof(*threadtextures));
+
+    if (!threadlumpframe || !threadlumps || !threadtextureframe || !threadtextures)
+	I_Error ("R_InitThreadPins: out of memory");
+}
+
+
+//
+// R_CacheLumpNum
+// W_CacheLumpNum for data drawn from by the renderer.
+//
+void *R_CacheLumpNum (int lump, int tag)
+{
+    if (!pincache)
+	return W_CacheLumpNum (lump, tag);
+
+    if (!threadlumpframe)
+	R_InitThreadPins ();
+
+    if (threadlumpframe[lump] != pinframe)
+    {
+	I_LockThreads ();
+	threadlumps[lump] = R_PinLump (lump);
+	I_UnlockThreads ();
+	threadlumpframe[lump] = pinframe;
+    }
+
+    return threadlumps[lump];
+}
+
+
+void R_ReleaseLumpNum (int lump)
+{
+    if (!pincache)
+	W_ReleaseLumpNum (lump);
+}
+
+
+//
+// R_PinComposite
+//
+static byte *R_PinComposite (int tex)
+{
+    if (!threadlumpframe)
+	R_InitThreadPins ();
+
+    if (threadtextureframe[tex] != pinframe)
+    {
+	I_LockThreads ();
+
+	if (!texturecomposite[tex])
+	    R_GenerateComposite (tex);
+
+	Z_ChangeTag (texturecomposite[tex], PU_STATIC);
+
+	if (texturepinframe[tex] != pinframe)
+	{
+	    texturepinframe[tex] = pinframe;
+	    pinnedtextures[numpinnedtextures++] = tex;
+	}
+
+	threadtextures[tex] = texturecomposite[tex];
+	I_UnlockThreads ();
+	threadtextureframe[tex] = pinframe;
+    }
+
+    return threadtextures[tex];
+}
+
+
+
+//
+// COMPOSED TEXTURES (-texatlas)
+// Every column of a texture, including those that point
+//  into a single patch, is kept outside the zone so that
+//  it is never purged and rebuilt in the middle of a frame.
+// A texture is laid out as its composite columns, followed
+//  by a copy of each patch its other columns point into,
+//  so the drawers read the same bytes as from the zone.
+// The textures of a level are composed into one block,
+//  the atlas, when it is loaded. Any other texture is
+//  composed when first drawn, and the least recently drawn
+//  of those are dropped to stay within texatlasbudget.
+//
+int		texatlasbudget;
+
+// Room before each texture, for the post header masked
+//  columns read, and after each block, as the drawers
+//  read up to 128 bytes from the start of a column.
+#define COMPOSEDPAD	8
+#define COMPOSEDTAIL	128
+
+typedef struct
+{
+    // The atlas, or a block of its own.
+    byte*	block;
+    bool	inatlas;
+
+    // Offset of each column in the block.
+    int*	columnofs;
+    int		size;
+
+    // Blocks of their own, most recently drawn first.
+    int		lastframe;
+    int		prev;
+    int		next;
+} composedtex_t;
+
+static composedtex_t*	composed;
+static int		composedhead = -1;
+static int		composedtail = -1;
+static int		composedmemory;
+
+static byte*		texatlas;
+static int		texatlassize;
+
+static THREAD_LOCAL int*	threadcomposedframe;
+static THREAD_LOCAL byte**	threadcomposed;
+
+
+static void R_InitComposed (void)
+{
+    int		i;
+
+    composed = calloc (numtextures, sizeof(*composed));
+    if (!composed)
+	I_Error ("R_InitComposed: out of memory");
+
+    for (i=0 ; i<numtextures ; i++)
+	composed[i].prev = composed[i].next = -1;
+}
+
+
+//
+// R_ComposedLayout
+// Sets where each column goes, returns the size.
+//
+static int R_ComposedLayout (int tex)
+{
+    composedtex_t*	c;
+    texture_t*		texture;
+    short*		collump;
+    unsigned short*	colofs;
+    int*		patchofs;
+    int			x;
+    int			i;
+
+    c = &composed[tex];
+
+    if (c->columnofs)
+	return c->size;
+
+    texture = textures[tex];
+    collump = texturecolumnlump[tex];
+    colofs = texturecolumnofs[tex];
+
+    c->columnofs = malloc (texture->width * sizeof(*c->columnofs));
+    patchofs = malloc (texture->patchcount * sizeof(*patchofs));
+    if (!c->columnofs || !patchofs)
+	I_Error ("R_ComposedLayout: out of memory");
+
+    for (i=0 ; i<texture->patchcount ; i++)
+	patchofs[i] = -1;
+
+    c->size = COMPOSEDPAD + texturecompositesize[tex];
+
+    for (x=0 ; x<texture->width ; x++)
+    {
+	if (collump[x] < 0)
+	{
+	    c->columnofs[x] = COMPOSEDPAD + colofs[x];
+	    continue;
+	}
+
+	// copy each patch once
+	for (i=0 ; texture->patches[i].patch != collump[x] ; i++)
+	    ;
+
+	if (patchofs[i] < 0)
+	{
+	    patchofs[i] = c->size;
+	    c->size += W_LumpLength (collump[x]);
+	}
+
+	c->columnofs[x] = patchofs[i] + colofs[x];
+    }
+
+    free (patchofs);
+
+    return c->size;
+}
+
+
+static void R_ComposeTexture (int tex, byte *block)
+{
+    composedtex_t*	c;
+    texture_t*		texture;
+    short*		collump;
+    int			x;
+
+    c = &composed[tex];
+    texture = textures[tex];
+    collump = texturecolumnlump[tex];
+
+    memset (block, 0, c->size);
+
+    R_ComposeColumns (tex, block + COMPOSEDPAD);
+
+    for (x=0 ; x<texture->width ; x++)
+    {
+	if (collump[x] < 0 || (x > 0 && collump[x] == collump[x-1]))
+	    continue;
+
+	memcpy (block + c->columnofs[x] - texturecolumnofs[tex][x],
+		W_CacheLumpNum (collump[x], PU_CACHE),
+		W_LumpLength (collump[x]));
+    }
+}
+
+
+static void R_UnlinkComposed (int tex)
+{
+    composedtex_t*	c;
+
+    c = &composed[tex];
+
+    if (c->prev >= 0)
+	composed[c->prev].next = c->next;
+    else
+	composedhead = c->next;
+
+    if (c->next >= 0)
+	composed[c->next].prev = c->prev;
+    else
+	composedtail = c->prev;
+
+    c->prev = c->next = -1;
+}
+
+
+static void R_FreeComposed (int tex)
+{
+    R_UnlinkComposed (tex);
+
+    free (composed[tex].block);
+    composed[tex].block = NULL;
+    composedmemory -= composed[tex].size;
+}
+
+
+//
+// R_EvictComposed
+// Drops the least recently drawn blocks until at most
+//  limit bytes are left. Blocks drawn in the current
+//  frame stay, as a thread may still be reading them.
+//
+static void R_EvictComposed (int limit)
+{
+    while (composedmemory > limit
+	   && composedtail >= 0
+	   && composed[composedtail].lastframe != framecount)
+    {
+	R_FreeComposed (composedtail);
+    }
+}
+
+
+//
+// R_CacheComposed
+// Must be called with the thread lock held.
+//
+static byte *R_CacheComposed (int tex)
+{
+    composedtex_t*	c;
+    int			size;
+
+    c = &composed[tex];
+
+    if (c->block)
+    {
+	R_UnlinkComposed (tex);
+    }
+    else
+    {
+	size = R_ComposedLayout (tex);
+	R_EvictComposed (texatlasbudget - texatlassize - size);
+
+	c->block = malloc (size + COMPOSEDTAIL);
+	if (!c->block)
+	    I_Error ("R_CacheComposed: out of memory (%i bytes)", size);
+
+	R_ComposeTexture (tex, c->block);
+	composedmemory += size;
+    }
+
+    c->next = composedhead;
+    if (composedhead >= 0)
+	composed[composedhead].prev = tex;
+    else
+	composedtail = tex;
+    composedhead = tex;
+
+    c->lastframe = framecount;
+
+    return c->block;
+}
+
+
+static byte *R_GetComposed (int tex)
+{
+    if (!threadcomposedframe)
+    {
+	threadcomposedframe = calloc (numtextures, sizeof(*threadcomposedframe));
+	threadcomposed = calloc (numtextures, sizeof(*threadcomposed));
+	if (!threadcomposedframe || !threadcomposed)
+	    I_Error ("R_GetComposed: out of memory");
+    }
+
+    // only take the lock once per texture and frame
+    if (threadcomposedframe[tex] != framecount)
+    {
+	I_LockThreads ();
+	threadcomposed[tex] = R_CacheComposed (tex);
+	I_UnlockThreads ();
+	threadcomposedframe[tex] = framecount;
+    }
+
+    return threadcomposed[tex];
+}
+
+
+//
+// R_BuildTextureAtlas
+// Composes the textures of the level into the atlas,
+//  as many as fit within texatlasbudget.
+//
+static void R_BuildTextureAtlas (void)
+{
+    char*	texturepresent;
+    int		i;
+    int		size;
+    int		ofs;
+
+    // drop the atlas of the previous level
+    for (i=0 ; i<numtextures ; i++)
+    {
+	if (composed[i].inatlas)
+	{
+	    composed[i].block = NULL;
+	    composed[i].inatlas = false;
+	}
+    }
+
+    free (texatlas);
+    texatlas = NULL;
+    texatlassize = 0;
+
+    texturepresent = Z_Malloc (numtextures, PU_STATIC, NULL);
+    memset (texturepresent, 0, numtextures);
+
+    for (i=0 ; i<numsides ; i++)
+    {
+	texturepresent[sides[i].toptexture] = 1;
+	texturepresent[sides[i].midtexture] = 1;
+	texturepresent[sides[i].bottomtexture] = 1;
+    }
+
+    texturepresent[skytexture] = 1;
+
+    size = 0;
+
+    for (i=0 ; i<numtextures ; i++)
+    {
+	if (!texturepresent[i])
+	    continue;
+
+	if (size + R_ComposedLayout (i) > texatlasbudget)
+	{
+	    texturepresent[i] = 0;
+	    continue;
+	}
+
+	size += composed[i].size;
+
+	// now in the atlas instead
+	if (composed[i].block)
+	    R_FreeComposed (i);
+    }
+
+    texatlas = malloc (size + COMPOSEDTAIL);
+    if (!texatlas)
+	I_Error ("R_BuildTextureAtlas: out of memory (%i bytes)", size);
+
+    texatlassize = size;
+
+    for (i=0, ofs=0 ; i<numtextures ; i++)
+    {
+	if (!texturepresent[i])
+	    continue;
+
+	composed[i].block = texatlas + ofs;
+	composed[i].inatlas = true;
+	R_ComposeTexture (i, composed[i].block);
+	ofs += composed[i].size;
+    }
+
+    Z_Free (texturepresent);
+
+    R_EvictComposed (texatlasbudget - texatlassize);
+}
+
+
+
 //
 // R_GetColumn
 //
@@ -386,13 +911,28 @@ R_GetColumn
 {
     int		lump;
     int		ofs;
+    byte*	block;
 
     col &= texturewidthmask[tex];
+
+    if (texatlasbudget)
+    {
+	if (composed[tex].inatlas)
+	    block = composed[tex].block;
+	else
+	    block = R_GetComposed (tex);
+
+	return block + composed[tex].columnofs[col];
+    }
+
     lump = texturecolumnlump[tex][col];
     ofs = texturecolumnofs[tex][col];
 
     if (lump > 0)
-	return (byte *)W_CacheLumpNum(lump,PU_CACHE)+ofs;
+	return (byte *)R_CacheLumpNum(lump,PU_CACHE)+ofs;
+
+    if (pincache)
+	return R_PinComposite(tex) + ofs;
 
     if (!texturecomposite[tex])
 	R_GenerateComposite (tex);
@@ -709,6 +1249,9 @@ void R_InitData (void)
     R_InitSpriteLumps ();
     printf (".");
     R_InitColormaps ();
+
+    if (texatlasbudget)
+	R_InitComposed ();
 }
 
 
@@ -813,6 +1356,9 @@ void R_PrecacheLevel (void)
     thinker_t*		th;
     spriteframe_t*	sf;
 
+    if (texatlasbudget)
+	R_BuildTextureAtlas ();
+
     if (demoplayback)
 	return;
 
@@ -862,7 +1408,7 @@ void R_PrecacheLevel (void)
     texturememory = 0;
     for (i=0 ; i<numtextures ; i++)
     {
-	if (!texturepresent[i])
+	if (!texturepresent[i] || (texatlasbudget && composed[i].inatlas))
 	    continue;
 
 	texture = textures[i];
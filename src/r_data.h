@@ -31,6 +31,19 @@ R_GetColumn
 ( int		tex,
   int		col );
 
+// Renderer versions of W_CacheLumpNum/W_ReleaseLumpNum,
+//  which keep data in place while strips render on several threads.
+void* R_CacheLumpNum (int lump, int tag);
+void R_ReleaseLumpNum (int lump);
+
+void R_PinCache (void);
+void R_UnpinCache (void);
+
+extern bool	pincache;
+
+// Memory for textures kept out of the zone, see -texatlas.
+extern int	texatlasbudget;
+
 
 // I/O, setting up the stuff.
 void R_InitData (void);
@@ -48,6 +48,7 @@
 #define SIL_TOP			2
 #define SIL_BOTH		3
 
+// Initial size of the drawseg pool.
 #define MAXDRAWSEGS		256
 
 
@@ -427,6 +428,9 @@ typedef struct
   int			lightlevel;
   int			minx;
   int			maxx;
+
+  // Next in the R_FindPlane hash chain, plus one.
+  int			hashnext;
   
   // leave pads for [minx-1]/[maxx+1]
   
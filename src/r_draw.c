@@ -21,6 +21,8 @@
 
 
 
+#include <stdlib.h>
+
 #include "doomdef.h"
 #include "deh_main.h"
 
@@ -36,6 +38,10 @@
 // State.
 #include "doomstat.h"
 
+#ifdef HAVE_AVX2_DRAWERS
+#include <immintrin.h>
+#endif
+
 
 // ?
 #define MAXWIDTH			1120
@@ -58,11 +64,19 @@ byte*		viewimage;
 int		viewwidth;
 int		scaledviewwidth;
 int		viewheight;
+int		scaledviewheight;
 int		viewwindowx;
 int		viewwindowy; 
 byte*		ylookup[MAXHEIGHT]; 
 int		columnofs[MAXWIDTH]; 
 
+// When rendering at a reduced resolution (viewscale > 1),
+//  the view is drawn to this buffer and then scaled up
+//  into the view window of I_VideoBuffer.
+static byte*	viewbuffer = NULL;
+static int	viewbufferwidth;
+static int	viewbufferheight;
+
 // Color tables for different players,
 //  translate a limited part to another
 //  (color ramps used for  suit colors).
@@ -79,15 +93,15 @@ static byte *background_buffer = NULL;
 // R_DrawColumn
 // Source is the top of the column to scale.
 //
-lighttable_t*		dc_colormap; 
-int			dc_x; 
-int			dc_yl; 
-int			dc_yh; 
-fixed_t			dc_iscale; 
-fixed_t			dc_texturemid;
+THREAD_LOCAL lighttable_t*		dc_colormap; 
+THREAD_LOCAL int			dc_x; 
+THREAD_LOCAL int			dc_yl; 
+THREAD_LOCAL int			dc_yh; 
+THREAD_LOCAL fixed_t			dc_iscale; 
+THREAD_LOCAL fixed_t			dc_texturemid;
 
 // first pixel in a column (possibly virtual) 
-byte*			dc_source;		
+THREAD_LOCAL byte*			dc_source;		
 
 // just for profiling 
 int			dccount;
@@ -269,7 +283,7 @@ int	fuzzoffset[FUZZTABLE] =
     FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF 
 }; 
 
-int	fuzzpos = 0; 
+THREAD_LOCAL int	fuzzpos = 0; 
 
 
 //
@@ -337,6 +351,29 @@ void R_DrawFuzzColumn (void)
     } while (count--); 
 } 
 
+//
+// R_SkipFuzzColumn
+// Steps fuzzpos as if the column had been drawn,
+//  so that all strips share one fuzz sequence.
+//
+void R_SkipFuzzColumn (void)
+{
+    int			count;
+
+    if (!dc_yl)
+	dc_yl = 1;
+
+    if (dc_yh == viewheight-1)
+	dc_yh = viewheight - 2;
+
+    count = dc_yh - dc_yl;
+
+    if (count < 0)
+	return;
+
+    fuzzpos = (fuzzpos + count + 1) % FUZZTABLE;
+}
+
 // low detail mode version
  
 void R_DrawFuzzColumnLow (void) 
@@ -418,7 +455,7 @@ void R_DrawFuzzColumnLow (void)
 //  of the BaronOfHell, the HellKnight, uses
 //  identical sprites, kinda brightened up.
 //
-byte*	dc_translation;
+THREAD_LOCAL byte*	dc_translation;
 byte*	translationtables;
 
 void R_DrawTranslatedColumn (void) 
@@ -567,19 +604,19 @@ void R_InitTranslationTables (void)
 // In consequence, flats are not stored by column (like walls),
 //  and the inner loop has to step in texture space u and v.
 //
-int			ds_y; 
-int			ds_x1; 
-int			ds_x2;
+THREAD_LOCAL int			ds_y; 
+THREAD_LOCAL int			ds_x1; 
+THREAD_LOCAL int			ds_x2;
 
-lighttable_t*		ds_colormap; 
+THREAD_LOCAL lighttable_t*		ds_colormap; 
 
-fixed_t			ds_xfrac; 
-fixed_t			ds_yfrac; 
-fixed_t			ds_xstep; 
-fixed_t			ds_ystep;
+THREAD_LOCAL fixed_t			ds_xfrac; 
+THREAD_LOCAL fixed_t			ds_yfrac; 
+THREAD_LOCAL fixed_t			ds_xstep; 
+THREAD_LOCAL fixed_t			ds_ystep;
 
 // start of a 64*64 tile image 
-byte*			ds_source;	
+THREAD_LOCAL byte*			ds_source;	
 
 // just for profiling
 int			dscount;
@@ -713,6 +750,28 @@ void R_DrawSpan (void)
 #endif
 
 
+//
+// R_StepSpan
+// Used to start a span at the edge of a strip.
+// The drawers step a packed position, which rounds
+//  differently from stepping ds_xfrac and ds_yfrac.
+//
+void R_StepSpan (int count)
+{
+    unsigned int position, step;
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    position += step * count;
+
+    ds_xfrac = (position >> 16) << 6;
+    ds_yfrac = (position & 0x0000ffff) << 6;
+}
+
+
 //
 // Again..
 //
@@ -766,8 +825,810 @@ void R_DrawSpanLow (void)
     } while (count--);
 }
 
+
+//
+// R_DrawLitSpan
+// For flats with the colormap already applied,
+//  see R_GetLitFlat.
+//
+void R_DrawLitSpan (void)
+{
+    unsigned int position, step;
+    byte *dest;
+    int count;
+    int spot;
+    unsigned int xtemp, ytemp;
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawLitSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+
+    count = ds_x2 - ds_x1;
+
+    do
+    {
+        ytemp = (position >> 4) & 0x0fc0;
+        xtemp = (position >> 26);
+        spot = xtemp | ytemp;
+
+	*dest++ = ds_source[spot];
+
+        position += step;
+
+    } while (count--);
+}
+
+
+void R_DrawLitSpanLow (void)
+{
+    unsigned int position, step;
+    unsigned int xtemp, ytemp;
+    byte *dest;
+    int count;
+    int spot;
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawLitSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    count = (ds_x2 - ds_x1);
+
+    // Blocky mode, need to multiply by 2.
+    dest = ylookup[ds_y] + columnofs[ds_x1 << 1];
+
+    do
+    {
+        ytemp = (position >> 4) & 0x0fc0;
+        xtemp = (position >> 26);
+        spot = xtemp | ytemp;
+
+	*dest++ = ds_source[spot];
+	*dest++ = ds_source[spot];
+
+	position += step;
+
+    } while (count--);
+}
+
+
+
+//
+// DRAWER VARIANTS (-drawers)
+// The same column and span loops, stepping several pixels
+//  at a time. Every pixel is still computed from its own
+//  fixed point position, so the output is exactly that of
+//  the drawers above.
+//
+
+drawvariant_t		drawvariant = drawvariant_auto;
+
+void			(*columndrawer) (void);
+void			(*columndrawerlow) (void);
+void			(*spandrawer) (void);
+void			(*spandrawerlow) (void);
+
+// The packed span position, see R_DrawSpan.
+#define SPANSPOT(position) \
+    ((((position) >> 4) & 0x0fc0) | ((position) >> 26))
+
+
+//
+// R_DrawColumnUnrolled
+//
+static void R_DrawColumnUnrolled (void)
+{
+    int			count;
+    byte*		dest;
+    byte*		source;
+    lighttable_t*	colormap;
+    unsigned int	frac;
+    unsigned int	fracstep;
+
+    count = dc_yh - dc_yl + 1;
+
+    if (count <= 0)
+	return;
+
+#ifdef RANGECHECK
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT)
+	I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x);
+#endif
+
+    dest = ylookup[dc_yl] + columnofs[dc_x];
+    source = dc_source;
+    colormap = dc_colormap;
+
+    fracstep = dc_iscale;
+    frac = dc_texturemid + (dc_yl-centery)*dc_iscale;
+
+    while (count >= 4)
+    {
+	dest[0] = colormap[source[(frac>>FRACBITS)&127]];
+	dest[SCREENWIDTH] = colormap[source[((frac+fracstep)>>FRACBITS)&127]];
+	dest[SCREENWIDTH*2] = colormap[source[((frac+fracstep*2)>>FRACBITS)&127]];
+	dest[SCREENWIDTH*3] = colormap[source[((frac+fracstep*3)>>FRACBITS)&127]];
+
+	frac += fracstep*4;
+	dest += SCREENWIDTH*4;
+	count -= 4;
+    }
+
+    while (count--)
+    {
+	*dest = colormap[source[(frac>>FRACBITS)&127]];
+	dest += SCREENWIDTH;
+	frac += fracstep;
+    }
+}
+
+
+static void R_DrawColumnLowUnrolled (void)
+{
+    int			count;
+    byte*		dest;
+    byte*		source;
+    lighttable_t*	colormap;
+    unsigned int	frac;
+    unsigned int	fracstep;
+    byte		pixel;
+
+    count = dc_yh - dc_yl + 1;
+
+    if (count <= 0)
+	return;
+
+#ifdef RANGECHECK
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT)
+	I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x);
+#endif
+
+    // Blocky mode, both pixels of a pair are adjacent.
+    dest = ylookup[dc_yl] + columnofs[dc_x << 1];
+    source = dc_source;
+    colormap = dc_colormap;
+
+    fracstep = dc_iscale;
+    frac = dc_texturemid + (dc_yl-centery)*dc_iscale;
+
+    while (count >= 4)
+    {
+	pixel = colormap[source[(frac>>FRACBITS)&127]];
+	dest[0] = dest[1] = pixel;
+	pixel = colormap[source[((frac+fracstep)>>FRACBITS)&127]];
+	dest[SCREENWIDTH] = dest[SCREENWIDTH+1] = pixel;
+	pixel = colormap[source[((frac+fracstep*2)>>FRACBITS)&127]];
+	dest[SCREENWIDTH*2] = dest[SCREENWIDTH*2+1] = pixel;
+	pixel = colormap[source[((frac+fracstep*3)>>FRACBITS)&127]];
+	dest[SCREENWIDTH*3] = dest[SCREENWIDTH*3+1] = pixel;
+
+	frac += fracstep*4;
+	dest += SCREENWIDTH*4;
+	count -= 4;
+    }
+
+    while (count--)
+    {
+	dest[0] = dest[1] = colormap[source[(frac>>FRACBITS)&127]];
+	dest += SCREENWIDTH;
+	frac += fracstep;
+    }
+}
+
+
+//
+// R_DrawSpanUnrolled
+//
+static void R_DrawSpanUnrolled (void)
+{
+    unsigned int	position, step;
+    byte*		dest;
+    byte*		source;
+    lighttable_t*	colormap;
+    int			count;
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+    source = ds_source;
+    colormap = ds_colormap;
+    count = ds_x2 - ds_x1 + 1;
+
+    while (count >= 4)
+    {
+	dest[0] = colormap[source[SPANSPOT(position)]];
+	dest[1] = colormap[source[SPANSPOT(position+step)]];
+	dest[2] = colormap[source[SPANSPOT(position+step*2)]];
+	dest[3] = colormap[source[SPANSPOT(position+step*3)]];
+
+	position += step*4;
+	dest += 4;
+	count -= 4;
+    }
+
+    while (count-- > 0)
+    {
+	*dest++ = colormap[source[SPANSPOT(position)]];
+	position += step;
+    }
+}
+
+
+static void R_DrawSpanLowUnrolled (void)
+{
+    unsigned int	position, step;
+    byte*		dest;
+    byte*		source;
+    lighttable_t*	colormap;
+    int			count;
+    byte		pixel;
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    count = ds_x2 - ds_x1 + 1;
+
+    // Blocky mode, need to multiply by 2.
+    ds_x1 <<= 1;
+    ds_x2 <<= 1;
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+    source = ds_source;
+    colormap = ds_colormap;
+
+    while (count >= 4)
+    {
+	pixel = colormap[source[SPANSPOT(position)]];
+	dest[0] = dest[1] = pixel;
+	pixel = colormap[source[SPANSPOT(position+step)]];
+	dest[2] = dest[3] = pixel;
+	pixel = colormap[source[SPANSPOT(position+step*2)]];
+	dest[4] = dest[5] = pixel;
+	pixel = colormap[source[SPANSPOT(position+step*3)]];
+	dest[6] = dest[7] = pixel;
+
+	position += step*4;
+	dest += 8;
+	count -= 4;
+    }
+
+    while (count-- > 0)
+    {
+	pixel = colormap[source[SPANSPOT(position)]];
+	dest[0] = dest[1] = pixel;
+	position += step;
+	dest += 2;
+    }
+}
+
+
+#ifdef HAVE_AVX2_DRAWERS
+
+//
+// AVX2 span drawers.
+// Eight pixels are looked up at once with gathers. A gather
+//  reads four bytes, so each one reads the aligned four the
+//  byte is in, counting from the start of the table, and
+//  shifts the byte down. Flats and colormaps are a multiple
+//  of four bytes long, so this never reads outside them.
+// Columns keep the unrolled drawers: their pixels are a
+//  screen row apart, and storing them one by one costs more
+//  than the gathers save.
+//
+
+#define AVX2_DRAWER	__attribute__((target("avx2")))
+
+// Looks up the byte at each index, into the bottom of
+//  its lane, with the bytes after it above.
+AVX2_DRAWER static inline __m256i R_GatherBytes (byte *table,
+						 __m256i index)
+{
+    __m256i	three;
+    __m256i	word;
+
+    three = _mm256_set1_epi32 (3);
+    word = _mm256_i32gather_epi32 ((const int *) table,
+				   _mm256_andnot_si256 (three, index), 1);
+
+    return _mm256_srlv_epi32 (word, _mm256_slli_epi32 (_mm256_and_si256 (index, three), 3));
+}
+
+
+// Looks up the eight texels at index, then their colors.
+AVX2_DRAWER static inline __m256i R_Gather8 (byte *source,
+					     lighttable_t *colormap,
+					     __m256i index)
+{
+    __m256i	texel;
+
+    texel = _mm256_and_si256 (R_GatherBytes (source, index),
+			      _mm256_set1_epi32 (0xff));
+
+    return R_GatherBytes (colormap, texel);
+}
+
+
+AVX2_DRAWER static void R_DrawSpanAVX2Common (int pairs)
+{
+    unsigned int	position, step;
+    byte*		dest;
+    int			count;
+    byte		pixel;
+    __m256i		positions;
+    __m256i		step8;
+    __m256i		spots;
+    __m256i		pixels;
+    __m256i		pick;
+    __m256i		gather;
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    count = ds_x2 - ds_x1 + 1;
+
+    if (pairs)
+    {
+	ds_x1 <<= 1;
+	ds_x2 <<= 1;
+    }
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+
+    if (count >= 8)
+    {
+	positions = _mm256_add_epi32 (_mm256_set1_epi32 (position),
+				      _mm256_mullo_epi32 (_mm256_set1_epi32 (step),
+							  _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7)));
+	step8 = _mm256_set1_epi32 (step*8);
+
+	// Packs the bottom byte of each pixel at the bottom
+	//  of its lane, doubled in low detail, then the
+	//  bottoms of both lanes together.
+	if (pairs)
+	{
+	    pick = _mm256_setr_epi8 (0, 0, 4, 4, 8, 8, 12, 12,
+				     -1, -1, -1, -1, -1, -1, -1, -1,
+				     0, 0, 4, 4, 8, 8, 12, 12,
+				     -1, -1, -1, -1, -1, -1, -1, -1);
+	    gather = _mm256_setr_epi32 (0, 1, 4, 5, 2, 3, 6, 7);
+	}
+	else
+	{
+	    pick = _mm256_setr_epi8 (0, 4, 8, 12, -1, -1, -1, -1,
+				     -1, -1, -1, -1, -1, -1, -1, -1,
+				     0, 4, 8, 12, -1, -1, -1, -1,
+				     -1, -1, -1, -1, -1, -1, -1, -1);
+	    gather = _mm256_setr_epi32 (0, 4, 1, 2, 3, 5, 6, 7);
+	}
+
+	while (count >= 8)
+	{
+	    spots = _mm256_or_si256 (_mm256_and_si256 (_mm256_srli_epi32 (positions, 4),
+						       _mm256_set1_epi32 (0x0fc0)),
+				     _mm256_srli_epi32 (positions, 26));
+	    pixels = R_Gather8 (ds_source, ds_colormap, spots);
+	    pixels = _mm256_shuffle_epi8 (pixels, pick);
+	    pixels = _mm256_permutevar8x32_epi32 (pixels, gather);
+
+	    if (pairs)
+	    {
+		_mm_storeu_si128 ((__m128i *) dest, _mm256_castsi256_si128 (pixels));
+		dest += 16;
+	    }
+	    else
+	    {
+		_mm_storel_epi64 ((__m128i *) dest, _mm256_castsi256_si128 (pixels));
+		dest += 8;
+	    }
+
+	    positions = _mm256_add_epi32 (positions, step8);
+	    position += step*8;
+	    count -= 8;
+	}
+    }
+
+    while (count-- > 0)
+    {
+	pixel = ds_colormap[ds_source[SPANSPOT(position)]];
+	*dest++ = pixel;
+	if (pairs)
+	    *dest++ = pixel;
+	position += step;
+    }
+}
+
+
+AVX2_DRAWER static void R_DrawSpanAVX2 (void)
+{
+    R_DrawSpanAVX2Common (0);
+}
+
+
+AVX2_DRAWER static void R_DrawSpanLowAVX2 (void)
+{
+    R_DrawSpanAVX2Common (1);
+}
+
+#endif
+
+
+//
+// R_InitDrawers
+//
+void R_InitDrawers (void)
+{
+    drawvariant_t	variant;
+
+    variant = drawvariant;
+
+    if (variant == drawvariant_auto)
+    {
+	variant = drawvariant_unrolled;
+#ifdef HAVE_AVX2_DRAWERS
+	if (__builtin_cpu_supports ("avx2"))
+	    variant = drawvariant_avx2;
+#endif
+    }
+
+    switch (variant)
+    {
+      case drawvariant_scalar:
+	columndrawer = R_DrawColumn;
+	columndrawerlow = R_DrawColumnLow;
+	spandrawer = R_DrawSpan;
+	spandrawerlow = R_DrawSpanLow;
+	break;
+
+      case drawvariant_avx2:
+#ifdef HAVE_AVX2_DRAWERS
+	if (!__builtin_cpu_supports ("avx2"))
+	    I_Error ("R_InitDrawers: AVX2 is not supported by this CPU");
+	columndrawer = R_DrawColumnUnrolled;
+	columndrawerlow = R_DrawColumnLowUnrolled;
+	spandrawer = R_DrawSpanAVX2;
+	spandrawerlow = R_DrawSpanLowAVX2;
+	break;
+#else
+	I_Error ("R_InitDrawers: AVX2 drawers are not in this build");
+#endif
+
+      default:
+	columndrawer = R_DrawColumnUnrolled;
+	columndrawerlow = R_DrawColumnLowUnrolled;
+	spandrawer = R_DrawSpanUnrolled;
+	spandrawerlow = R_DrawSpanLowUnrolled;
+	break;
+    }
+}
+
+
+//
+// DEFERRED DRAWING (-deferdraw)
+// The visibility pass only records what the drawers
+//  would have been called with, and the columns and spans
+//  are filled in afterwards by the render threads.
+// The view is split into column ranges, one command buffer
+//  each, so no two threads ever write the same pixel.
+// Within a buffer, commands run in the order they were
+//  recorded, which keeps sprites and masked walls on top.
+//
+
+// A column covers x1 == x2, a span y1 == y2.
+// Columns step in y: yfrac is dc_texturemid, ystep dc_iscale.
+typedef struct
+{
+    void		(*func) (void);
+    byte*		source;
+    lighttable_t*	colormap;
+    byte*		translation;
+    fixed_t		xfrac;
+    fixed_t		yfrac;
+    fixed_t		xstep;
+    fixed_t		ystep;
+    short		x1;
+    short		x2;
+    short		y1;
+    short		y2;
+    int			fuzzpos;
+} drawcmd_t;
+
+typedef struct
+{
+    drawcmd_t*		cmds;
+    int			numcmds;
+    int			maxcmds;
+    int			x1;
+    int			x2;
+} drawbuffer_t;
+
+static drawbuffer_t	drawbuffers[SCREENWIDTH];
+static int		numdrawbuffers;
+
+// Buffer that owns each column of the view.
+static int		drawbufferofs[SCREENWIDTH];
+
+// The drawers the commands end up calling.
+static void		(*drawcolumn) (void);
+static void		(*drawfuzzcolumn) (void);
+static void		(*drawtranscolumn) (void);
+static void		(*drawspan) (void);
+static void		(*drawlitspan) (void);
+
+
+static drawcmd_t *R_NewDrawCommand (int buffer)
+{
+    drawbuffer_t*	buf;
+
+    buf = &drawbuffers[buffer];
+
+    if (buf->numcmds == buf->maxcmds)
+    {
+	buf->maxcmds = buf->maxcmds ? buf->maxcmds*2 : 1024;
+	buf->cmds = realloc (buf->cmds, buf->maxcmds * sizeof(*buf->cmds));
+	if (!buf->cmds)
+	    I_Error ("R_NewDrawCommand: out of memory");
+    }
+
+    return &buf->cmds[buf->numcmds++];
+}
+
+
+static void R_QueueColumnCommand (void (*func) (void))
+{
+    drawcmd_t*	cmd;
+
+    cmd = R_NewDrawCommand (drawbufferofs[dc_x]);
+    cmd->func = func;
+    cmd->source = dc_source;
+    cmd->colormap = dc_colormap;
+    cmd->translation = dc_translation;
+    cmd->yfrac = dc_texturemid;
+    cmd->ystep = dc_iscale;
+    cmd->x1 = cmd->x2 = dc_x;
+    cmd->y1 = dc_yl;
+    cmd->y2 = dc_yh;
+    cmd->fuzzpos = fuzzpos;
+}
+
+
+static void R_QueueColumn (void)
+{
+    R_QueueColumnCommand (drawcolumn);
+}
+
+
+static void R_QueueFuzzColumn (void)
+{
+    R_QueueColumnCommand (drawfuzzcolumn);
+    R_SkipFuzzColumn ();
+}
+
+
+static void R_QueueTranslatedColumn (void)
+{
+    R_QueueColumnCommand (drawtranscolumn);
+}
+
+
+// A span goes into every buffer it crosses.
+static void R_QueueSpanCommand (void (*func) (void))
+{
+    drawcmd_t*	cmd;
+    int		i;
+
+    for (i=drawbufferofs[ds_x1] ; i<=drawbufferofs[ds_x2] ; i++)
+    {
+	cmd = R_NewDrawCommand (i);
+	cmd->func = func;
+	cmd->source = ds_source;
+	cmd->colormap = ds_colormap;
+	cmd->xfrac = ds_xfrac;
+	cmd->yfrac = ds_yfrac;
+	cmd->xstep = ds_xstep;
+	cmd->ystep = ds_ystep;
+	cmd->x1 = ds_x1;
+	cmd->x2 = ds_x2;
+	cmd->y1 = cmd->y2 = ds_y;
+    }
+}
+
+
+static void R_QueueSpan (void)
+{
+    R_QueueSpanCommand (drawspan);
+}
+
+
+static void R_QueueLitSpan (void)
+{
+    R_QueueSpanCommand (drawlitspan);
+}
+
+
 //
-// R_InitBuffer 
+// R_DeferDrawers
+// Called by R_ExecuteSetViewSize once the drawers
+//  for the detail level are set.
+//
+void R_DeferDrawers (void)
+{
+    drawcolumn = basecolfunc;
+    drawfuzzcolumn = fuzzcolfunc;
+    drawtranscolumn = transcolfunc;
+    drawspan = spanfunc;
+    drawlitspan = litspanfunc;
+
+    colfunc = basecolfunc = R_QueueColumn;
+    fuzzcolfunc = R_QueueFuzzColumn;
+    transcolfunc = R_QueueTranslatedColumn;
+    spanfunc = R_QueueSpan;
+    litspanfunc = R_QueueLitSpan;
+}
+
+
+//
+// R_ClearDrawCommands
+// Called at the start of a frame.
+//
+void R_ClearDrawCommands (int buffers)
+{
+    int		i;
+    int		x;
+
+    if (buffers > viewwidth)
+	buffers = viewwidth;
+
+    numdrawbuffers = buffers;
+
+    for (i=0 ; i<numdrawbuffers ; i++)
+    {
+	drawbuffers[i].numcmds = 0;
+	drawbuffers[i].x1 = viewwidth*i/numdrawbuffers;
+	drawbuffers[i].x2 = viewwidth*(i+1)/numdrawbuffers - 1;
+
+	for (x=drawbuffers[i].x1 ; x<=drawbuffers[i].x2 ; x++)
+	    drawbufferofs[x] = i;
+    }
+}
+
+
+static void R_RunDrawBuffer (void *unused, int buffer)
+{
+    drawbuffer_t*	buf;
+    drawcmd_t*		cmd;
+    drawcmd_t*		end;
+
+    buf = &drawbuffers[buffer];
+    end = buf->cmds + buf->numcmds;
+
+    for (cmd=buf->cmds ; cmd<end ; cmd++)
+    {
+	if (cmd->func == drawspan || cmd->func == drawlitspan)
+	{
+	    ds_source = cmd->source;
+	    ds_colormap = cmd->colormap;
+	    ds_xfrac = cmd->xfrac;
+	    ds_yfrac = cmd->yfrac;
+	    ds_xstep = cmd->xstep;
+	    ds_ystep = cmd->ystep;
+	    ds_y = cmd->y1;
+	    ds_x1 = cmd->x1;
+	    ds_x2 = cmd->x2;
+
+	    if (ds_x1 < buf->x1)
+	    {
+		R_StepSpan (buf->x1 - ds_x1);
+		ds_x1 = buf->x1;
+	    }
+	    if (ds_x2 > buf->x2)
+		ds_x2 = buf->x2;
+	}
+	else
+	{
+	    dc_source = cmd->source;
+	    dc_colormap = cmd->colormap;
+	    dc_translation = cmd->translation;
+	    dc_texturemid = cmd->yfrac;
+	    dc_iscale = cmd->ystep;
+	    dc_x = cmd->x1;
+	    dc_yl = cmd->y1;
+	    dc_yh = cmd->y2;
+	    fuzzpos = cmd->fuzzpos;
+	}
+
+	cmd->func ();
+    }
+}
+
+
+//
+// R_RunDrawCommands
+// Fills in everything recorded since R_ClearDrawCommands.
+//
+void R_RunDrawCommands (void)
+{
+    int		savedfuzzpos;
+
+    // the recording already stepped the fuzz for the whole frame
+    savedfuzzpos = fuzzpos;
+
+    I_RunThreads (R_RunDrawBuffer, NULL, numdrawbuffers);
+
+    fuzzpos = savedfuzzpos;
+}
+
+
+//
+// R_InitBuffer
 // Creats lookup tables that avoid
 //  multiplies and other hazzles
 //  for getting the framebuffer address
@@ -783,22 +1644,88 @@ R_InitBuffer
     // Handle resize,
     //  e.g. smaller view windows
     //  with border and/or status bar.
-    viewwindowx = (SCREENWIDTH-width) >> 1; 
-
-    // Column offset. For windows.
-    for (i=0 ; i<width ; i++) 
-	columnofs[i] = viewwindowx + i;
+    viewwindowx = (SCREENWIDTH-scaledviewwidth) >> 1; 
 
     // Samw with base row offset.
-    if (width == SCREENWIDTH) 
+    if (scaledviewwidth == SCREENWIDTH) 
 	viewwindowy = 0; 
     else 
-	viewwindowy = (SCREENHEIGHT-SBARHEIGHT-height) >> 1; 
+	viewwindowy = (SCREENHEIGHT-SBARHEIGHT-scaledviewheight) >> 1; 
+
+    if (viewscale > 1)
+    {
+	// Draw to the top left corner of a separate buffer,
+	//  keeping the SCREENWIDTH pitch the drawers expect.
+	if (viewbuffer == NULL)
+	    viewbuffer = Z_Malloc(SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);
+
+	viewbufferwidth = width;
+	viewbufferheight = height;
+
+	for (i=0 ; i<width ; i++) 
+	    columnofs[i] = i;
+
+	for (i=0 ; i<height ; i++) 
+	    ylookup[i] = viewbuffer + i*SCREENWIDTH; 
+
+	return;
+    }
+
+    if (viewbuffer != NULL)
+    {
+	Z_Free(viewbuffer);
+	viewbuffer = NULL;
+    }
+
+    // Column offset. For windows.
+    for (i=0 ; i<width ; i++) 
+	columnofs[i] = viewwindowx + i;
 
     // Preclaculate all row offsets.
     for (i=0 ; i<height ; i++) 
 	ylookup[i] = I_VideoBuffer + (i+viewwindowy)*SCREENWIDTH; 
 } 
+
+
+//
+// R_ScaleViewBuffer
+// Scales the reduced resolution view up
+//  into the view window, duplicating pixels.
+//
+void R_ScaleViewBuffer (void)
+{
+    int		x;
+    int		y;
+    int		i;
+    int		width;
+    int		height;
+    byte*	src;
+    byte*	dest;
+
+    if (viewbuffer == NULL)
+	return;
+
+    for (y=0 ; y<viewbufferheight ; y++)
+    {
+	src = viewbuffer + y*SCREENWIDTH;
+	dest = I_VideoBuffer + (viewwindowy + y*viewscale)*SCREENWIDTH + viewwindowx;
+
+	for (x=0 ; x<viewbufferwidth && x*viewscale<scaledviewwidth ; x++)
+	{
+	    width = scaledviewwidth - x*viewscale;
+	    if (width > viewscale)
+		width = viewscale;
+	    memset(dest + x*viewscale, src[x], width);
+	}
+
+	height = scaledviewheight - y*viewscale;
+	if (height > viewscale)
+	    height = viewscale;
+
+	for (i=1 ; i<height ; i++)
+	    memcpy(dest + i*SCREENWIDTH, dest, scaledviewwidth);
+    }
+}
  
  
 
@@ -881,14 +1808,14 @@ void R_FillBackScreen (void)
     patch = W_CacheLumpName(DEH_String("brdr_b"),PU_CACHE);
 
     for (x=0 ; x<scaledviewwidth ; x+=8)
-	V_DrawPatch(viewwindowx+x, viewwindowy+viewheight, patch);
+	V_DrawPatch(viewwindowx+x, viewwindowy+scaledviewheight, patch);
     patch = W_CacheLumpName(DEH_String("brdr_l"),PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
+    for (y=0 ; y<scaledviewheight ; y+=8)
 	V_DrawPatch(viewwindowx-8, viewwindowy+y, patch);
     patch = W_CacheLumpName(DEH_String("brdr_r"),PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
+    for (y=0 ; y<scaledviewheight ; y+=8)
 	V_DrawPatch(viewwindowx+scaledviewwidth, viewwindowy+y, patch);
 
     // Draw beveled edge. 
@@ -901,11 +1828,11 @@ void R_FillBackScreen (void)
                 W_CacheLumpName(DEH_String("brdr_tr"),PU_CACHE));
     
     V_DrawPatch(viewwindowx-8,
-                viewwindowy+viewheight,
+                viewwindowy+scaledviewheight,
                 W_CacheLumpName(DEH_String("brdr_bl"),PU_CACHE));
     
     V_DrawPatch(viewwindowx+scaledviewwidth,
-                viewwindowy+viewheight,
+                viewwindowy+scaledviewheight,
                 W_CacheLumpName(DEH_String("brdr_br"),PU_CACHE));
 
     V_RestoreBuffer();
@@ -948,21 +1875,21 @@ void R_DrawViewBorder (void)
     if (scaledviewwidth == SCREENWIDTH) 
 	return; 
   
-    top = ((SCREENHEIGHT-SBARHEIGHT)-viewheight)/2; 
+    top = ((SCREENHEIGHT-SBARHEIGHT)-scaledviewheight)/2; 
     side = (SCREENWIDTH-scaledviewwidth)/2; 
  
     // copy top and one line of left side 
     R_VideoErase (0, top*SCREENWIDTH+side); 
  
     // copy one line of right side and bottom 
-    ofs = (viewheight+top)*SCREENWIDTH-side; 
+    ofs = (scaledviewheight+top)*SCREENWIDTH-side; 
     R_VideoErase (ofs, top*SCREENWIDTH+side); 
  
     // copy sides using wraparound 
     ofs = top*SCREENWIDTH + SCREENWIDTH-side; 
     side <<= 1;
     
-    for (i=1 ; i<viewheight ; i++) 
+    for (i=1 ; i<scaledviewheight ; i++) 
     { 
 	R_VideoErase (ofs, side); 
 	ofs += SCREENWIDTH; 
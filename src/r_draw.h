@@ -20,18 +20,25 @@
 #ifndef __R_DRAW__
 #define __R_DRAW__
 
+#include "i_thread.h"
+
+// The AVX2 drawers need GCC style target attributes.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_DRAWERS
+#endif
+
 
 
 
-extern lighttable_t*	dc_colormap;
-extern int		dc_x;
-extern int		dc_yl;
-extern int		dc_yh;
-extern fixed_t		dc_iscale;
-extern fixed_t		dc_texturemid;
+extern THREAD_LOCAL lighttable_t*	dc_colormap;
+extern THREAD_LOCAL int		dc_x;
+extern THREAD_LOCAL int		dc_yl;
+extern THREAD_LOCAL int		dc_yh;
+extern THREAD_LOCAL fixed_t		dc_iscale;
+extern THREAD_LOCAL fixed_t		dc_texturemid;
 
 // first pixel in a column
-extern byte*		dc_source;		
+extern THREAD_LOCAL byte*		dc_source;		
 
 
 // The span blitting interface.
@@ -44,6 +51,11 @@ void 	R_DrawColumnLow (void);
 void 	R_DrawFuzzColumn (void);
 void 	R_DrawFuzzColumnLow (void);
 
+// Steps the effect over a column drawn by another strip.
+void	R_SkipFuzzColumn (void);
+
+extern THREAD_LOCAL int	fuzzpos;
+
 // Draw with color translation tables,
 //  for player sprite rendering,
 //  Green/Red/Blue/Indigo shirts.
@@ -55,22 +67,22 @@ R_VideoErase
 ( unsigned	ofs,
   int		count );
 
-extern int		ds_y;
-extern int		ds_x1;
-extern int		ds_x2;
+extern THREAD_LOCAL int		ds_y;
+extern THREAD_LOCAL int		ds_x1;
+extern THREAD_LOCAL int		ds_x2;
 
-extern lighttable_t*	ds_colormap;
+extern THREAD_LOCAL lighttable_t*	ds_colormap;
 
-extern fixed_t		ds_xfrac;
-extern fixed_t		ds_yfrac;
-extern fixed_t		ds_xstep;
-extern fixed_t		ds_ystep;
+extern THREAD_LOCAL fixed_t		ds_xfrac;
+extern THREAD_LOCAL fixed_t		ds_yfrac;
+extern THREAD_LOCAL fixed_t		ds_xstep;
+extern THREAD_LOCAL fixed_t		ds_ystep;
 
 // start of a 64*64 tile image
-extern byte*		ds_source;		
+extern THREAD_LOCAL byte*		ds_source;		
 
 extern byte*		translationtables;
-extern byte*		dc_translation;
+extern THREAD_LOCAL byte*		dc_translation;
 
 
 // Span blitting for rows, floor/ceiling.
@@ -80,12 +92,58 @@ void 	R_DrawSpan (void);
 // Low resolution mode, 160x200?
 void 	R_DrawSpanLow (void);
 
+// Same for pre-lit flats, ds_colormap is not used.
+void	R_DrawLitSpan (void);
+void	R_DrawLitSpanLow (void);
+
+// Steps ds_xfrac and ds_yfrac over count pixels of a span,
+//  exactly as the span drawers do.
+void	R_StepSpan (int count);
+
+
+// Column and span drawer variants, see -drawers.
+// All of them draw the same pixels.
+typedef enum
+{
+    drawvariant_auto,
+    drawvariant_scalar,
+    drawvariant_unrolled,
+    drawvariant_avx2
+} drawvariant_t;
+
+extern drawvariant_t	drawvariant;
+
+// The chosen variants, for high and low detail.
+extern void		(*columndrawer) (void);
+extern void		(*columndrawerlow) (void);
+extern void		(*spandrawer) (void);
+extern void		(*spandrawerlow) (void);
+
+// Picks the fastest variant the CPU supports,
+//  unless drawvariant asks for one.
+void R_InitDrawers (void);
+
 
 void
 R_InitBuffer
 ( int		width,
   int		height );
 
+// Scales a reduced resolution view up to the screen.
+void R_ScaleViewBuffer (void);
+
+
+// Deferred drawing, see -deferdraw.
+// Makes the drawer pointers record commands instead.
+void R_DeferDrawers (void);
+
+// Starts a frame of commands, split over the given
+//  number of buffers.
+void R_ClearDrawCommands (int buffers);
+
+// Draws the commands recorded this frame on the render threads.
+void R_RunDrawCommands (void);
+
 
 // Initialize color translation tables,
 //  for player rendering etc.
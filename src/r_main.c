@@ -23,14 +23,18 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 
 #include "doomdef.h"
 #include "d_loop.h"
+#include "i_system.h"
+#include "i_video.h"
 
 #include "m_bbox.h"
 #include "m_menu.h"
+#include "z_zone.h"
 
 #include "r_local.h"
 #include "r_sky.h"
@@ -51,7 +55,7 @@ int			validcount = 1;
 
 
 lighttable_t*		fixedcolormap;
-extern lighttable_t**	walllights;
+extern THREAD_LOCAL lighttable_t**	walllights;
 
 int			centerx;
 int			centery;
@@ -63,7 +67,7 @@ fixed_t			projection;
 // just for profiling purposes
 int			framecount;	
 
-int			sscount;
+THREAD_LOCAL int			sscount;
 int			linecount;
 int			loopcount;
 
@@ -81,6 +85,32 @@ player_t*		viewplayer;
 // 0 = high, 1 = low
 int			detailshift;	
 
+// Render the view at the output resolution
+//  instead of SCREENWIDTH x SCREENHEIGHT.
+bool			nativeres;
+
+// Number of screen pixels per rendered pixel
+//  in each direction.
+int			viewscale = 1;
+
+// Number of threads the view is rendered on,
+//  each drawing the columns stripx1..stripx2.
+int			rthreads = 1;
+THREAD_LOCAL int	stripx1;
+THREAD_LOCAL int	stripx2;
+
+// Find what to draw on one thread,
+//  then draw it on all of them.
+bool			deferdraw;
+
+// Report how much of the visplane, opening, drawseg
+//  and vissprite pools a frame needed at most.
+bool			rstats;
+static int		peakvisplanes;
+static int		peakopenings;
+static int		peakdrawsegs;
+static int		peakvissprites;
+
 //
 // precalculated math tables
 //
@@ -106,11 +136,12 @@ int			extralight;
 
 
 
-void (*colfunc) (void);
+THREAD_LOCAL void (*colfunc) (void);
 void (*basecolfunc) (void);
 void (*fuzzcolfunc) (void);
 void (*transcolfunc) (void);
 void (*spanfunc) (void);
+void (*litspanfunc) (void);
 
 
 
@@ -678,16 +709,22 @@ void R_ExecuteSetViewSize (void)
     if (setblocks == 11)
     {
 	scaledviewwidth = SCREENWIDTH;
-	viewheight = SCREENHEIGHT;
+	scaledviewheight = SCREENHEIGHT;
     }
     else
     {
 	scaledviewwidth = setblocks*32;
-	viewheight = (setblocks*168/10)&~7;
+	scaledviewheight = (setblocks*168/10)&~7;
     }
+
+    viewscale = 1;
+    if (nativeres && fb_scaling > 1)
+	viewscale = fb_scaling;
     
     detailshift = setdetail;
-    viewwidth = scaledviewwidth>>detailshift;
+    viewwidth = (scaledviewwidth+viewscale-1)/viewscale;
+    viewwidth = (viewwidth+(1<<detailshift)-1)>>detailshift;
+    viewheight = (scaledviewheight+viewscale-1)/viewscale;
 	
     centery = viewheight/2;
     centerx = viewwidth/2;
@@ -697,20 +734,25 @@ void R_ExecuteSetViewSize (void)
 
     if (!detailshift)
     {
-	colfunc = basecolfunc = R_DrawColumn;
+	colfunc = basecolfunc = columndrawer;
 	fuzzcolfunc = R_DrawFuzzColumn;
 	transcolfunc = R_DrawTranslatedColumn;
-	spanfunc = R_DrawSpan;
+	spanfunc = spandrawer;
+	litspanfunc = R_DrawLitSpan;
     }
     else
     {
-	colfunc = basecolfunc = R_DrawColumnLow;
+	colfunc = basecolfunc = columndrawerlow;
 	fuzzcolfunc = R_DrawFuzzColumnLow;
 	transcolfunc = R_DrawTranslatedColumnLow;
-	spanfunc = R_DrawSpanLow;
+	spanfunc = spandrawerlow;
+	litspanfunc = R_DrawLitSpanLow;
     }
 
-    R_InitBuffer (scaledviewwidth, viewheight);
+    if (deferdraw)
+	R_DeferDrawers ();
+
+    R_InitBuffer (viewwidth<<detailshift, viewheight);
 	
     R_InitTextureMapping ();
     
@@ -758,6 +800,38 @@ void R_ExecuteSetViewSize (void)
 
 
 
+//
+// R_UpdateStats
+// Called by every thread once its part of the frame is done.
+//
+static void R_UpdateStats (void)
+{
+    I_LockThreads ();
+
+    if (lastvisplane - visplanes > peakvisplanes)
+	peakvisplanes = lastvisplane - visplanes;
+    if (lastopening - openings > peakopenings)
+	peakopenings = lastopening - openings;
+    if (ds_p - drawsegs > peakdrawsegs)
+	peakdrawsegs = ds_p - drawsegs;
+    if (vissprite_p - vissprites > peakvissprites)
+	peakvissprites = vissprite_p - vissprites;
+
+    I_UnlockThreads ();
+}
+
+
+static void R_PrintStats (void)
+{
+    printf ("R_PrintStats: most used in one frame (original limit):\n");
+    printf ("  visplanes  %7i (%i)\n", peakvisplanes, MAXVISPLANES);
+    printf ("  openings   %7i (%i)\n", peakopenings, MAXOPENINGS);
+    printf ("  drawsegs   %7i (%i)\n", peakdrawsegs, MAXDRAWSEGS);
+    printf ("  vissprites %7i (%i)\n", peakvissprites, MAXVISSPRITES);
+}
+
+
+
 //
 // R_Init
 //
@@ -774,6 +848,7 @@ void R_Init (void)
     // viewwidth / viewheight / detailLevel are set by the defaults
     printf (".");
 
+    R_InitDrawers ();
     R_SetViewSize (screenblocks, detailLevel);
     R_InitPlanes ();
     printf (".");
@@ -781,7 +856,11 @@ void R_Init (void)
     printf (".");
     R_InitSkyMap ();
     R_InitTranslationTables ();
+    I_InitThreads (rthreads);
     printf (".");
+
+    if (rstats)
+	I_AtExit (R_PrintStats, true);
 	
     framecount = 0;
 }
@@ -857,13 +936,385 @@ void R_SetupFrame (player_t* player)
 
 
 
+//
+// VIEW REUSE (-reuseview)
+// While the player stands still and nothing in sight moves,
+//  for example with the game paused, every frame comes out
+//  the same. The last one is kept and copied back instead,
+//  for as long as a hash of everything it was drawn from
+//  stays the same: the view, the sectors, walls and things
+//  of the subsectors it reached, and the weapon sprites.
+//
+bool			reuseview;
+static byte*		lastview;
+static bool		lastviewvalid;
+static uint64_t		lastviewhash;
+
+// Subsectors reached by the last frame drawn.
+static int*		viewsubsectors;
+static int		numviewsubsectors;
+static int*		viewsubsectorframe;
+static int		maxviewsubsectors;
+
+// Hashes each sector once.
+static int*		viewsectorstamp;
+static int		maxviewsectors;
+static int		viewhashstamp;
+
+// Subsectors reached by the current strip.
+static THREAD_LOCAL int*	stripsubsectors;
+static THREAD_LOCAL int		numstripsubsectors;
+static THREAD_LOCAL int		maxstripsubsectors;
+
+#define HASHINT(hash, value) \
+    ((hash) = ((hash) ^ (uint32_t) (value)) * 0x100000001b3ULL)
+
+
+//
+// R_MarkViewSubsector
+// Called by R_Subsector.
+//
+void R_MarkViewSubsector (int num)
+{
+    if (maxstripsubsectors < numsubsectors)
+    {
+	maxstripsubsectors = numsubsectors;
+	stripsubsectors = realloc (stripsubsectors,
+				   maxstripsubsectors * sizeof(*stripsubsectors));
+	if (!stripsubsectors)
+	    I_Error ("R_MarkViewSubsector: out of memory");
+    }
+
+    // the BSP reaches each subsector once
+    stripsubsectors[numstripsubsectors++] = num;
+}
+
+
+//
+// R_MergeViewSubsectors
+// Adds the subsectors the current strip reached
+//  to those of the frame.
+//
+static void R_MergeViewSubsectors (void)
+{
+    int		i;
+    int		num;
+
+    I_LockThreads ();
+
+    for (i=0 ; i<numstripsubsectors ; i++)
+    {
+	num = stripsubsectors[i];
+
+	if (viewsubsectorframe[num] != framecount)
+	{
+	    viewsubsectorframe[num] = framecount;
+	    viewsubsectors[numviewsubsectors++] = num;
+	}
+    }
+
+    I_UnlockThreads ();
+
+    numstripsubsectors = 0;
+}
+
+
+static void R_ClearViewSubsectors (void)
+{
+    if (maxviewsubsectors < numsubsectors)
+    {
+	maxviewsubsectors = numsubsectors;
+	viewsubsectors = realloc (viewsubsectors,
+				  maxviewsubsectors * sizeof(*viewsubsectors));
+	viewsubsectorframe = realloc (viewsubsectorframe,
+				      maxviewsubsectors * sizeof(*viewsubsectorframe));
+	if (!viewsubsectors || !viewsubsectorframe)
+	    I_Error ("R_ClearViewSubsectors: out of memory");
+
+	memset (viewsubsectorframe, 0, maxviewsubsectors * sizeof(*viewsubsectorframe));
+    }
+
+    numviewsubsectors = 0;
+    numstripsubsectors = 0;
+}
+
+
+static uint64_t R_HashSector (uint64_t hash, sector_t *sector)
+{
+    mobj_t*	thing;
+
+    if (viewsectorstamp[sector-sectors] == viewhashstamp)
+	return hash;
+
+    viewsectorstamp[sector-sectors] = viewhashstamp;
+
+    HASHINT (hash, sector-sectors);
+    HASHINT (hash, sector->floorheight);
+    HASHINT (hash, sector->ceilingheight);
+    HASHINT (hash, sector->floorpic);
+    HASHINT (hash, sector->ceilingpic);
+    HASHINT (hash, flattranslation[sector->floorpic]);
+    HASHINT (hash, flattranslation[sector->ceilingpic]);
+    HASHINT (hash, sector->lightlevel);
+
+    for (thing=sector->thinglist ; thing ; thing=thing->snext)
+    {
+	HASHINT (hash, thing->x);
+	HASHINT (hash, thing->y);
+	HASHINT (hash, thing->z);
+	HASHINT (hash, thing->angle);
+	HASHINT (hash, thing->sprite);
+	HASHINT (hash, thing->frame);
+	HASHINT (hash, thing->flags);
+    }
+
+    return hash;
+}
+
+
+static uint64_t R_HashSide (uint64_t hash, side_t *side)
+{
+    HASHINT (hash, side->textureoffset);
+    HASHINT (hash, side->rowoffset);
+    HASHINT (hash, texturetranslation[side->toptexture]);
+    HASHINT (hash, texturetranslation[side->bottomtexture]);
+    HASHINT (hash, texturetranslation[side->midtexture]);
+
+    return hash;
+}
+
+
+//
+// R_ViewHash
+// Hashes what the last frame drawn was drawn from,
+//  with the fuzz effect starting at the given position.
+//
+static uint64_t R_ViewHash (int startfuzzpos)
+{
+    uint64_t		hash;
+    subsector_t*	sub;
+    seg_t*		seg;
+    pspdef_t*		psp;
+    int			i;
+    int			j;
+
+    hash = 0xcbf29ce484222325ULL;
+
+    HASHINT (hash, viewx);
+    HASHINT (hash, viewy);
+    HASHINT (hash, viewz);
+    HASHINT (hash, viewangle);
+    HASHINT (hash, extralight);
+    HASHINT (hash, fixedcolormap ? fixedcolormap - colormaps : -1);
+
+    HASHINT (hash, viewwindowx);
+    HASHINT (hash, viewwindowy);
+    HASHINT (hash, viewwidth);
+    HASHINT (hash, viewheight);
+    HASHINT (hash, scaledviewwidth);
+    HASHINT (hash, scaledviewheight);
+    HASHINT (hash, detailshift);
+
+    HASHINT (hash, startfuzzpos);
+    HASHINT (hash, skytexture);
+
+    if (maxviewsectors < numsectors)
+    {
+	maxviewsectors = numsectors;
+	viewsectorstamp = realloc (viewsectorstamp,
+				   maxviewsectors * sizeof(*viewsectorstamp));
+	if (!viewsectorstamp)
+	    I_Error ("R_ViewHash: out of memory");
+
+	memset (viewsectorstamp, 0, maxviewsectors * sizeof(*viewsectorstamp));
+	viewhashstamp = 0;
+    }
+
+    viewhashstamp++;
+
+    // the weapon is lit by the player's sector
+    hash = R_HashSector (hash, viewplayer->mo->subsector->sector);
+
+    for (i=0 ; i<numviewsubsectors ; i++)
+    {
+	sub = &subsectors[viewsubsectors[i]];
+	hash = R_HashSector (hash, sub->sector);
+
+	// the walls, and the sectors behind them
+	for (j=0, seg=&segs[sub->firstline] ; j<sub->numlines ; j++, seg++)
+	{
+	    hash = R_HashSide (hash, seg->sidedef);
+
+	    if (seg->backsector)
+		hash = R_HashSector (hash, seg->backsector);
+	}
+    }
+
+    for (i=0, psp=viewplayer->psprites ; i<NUMPSPRITES ; i++, psp++)
+    {
+	HASHINT (hash, psp->state ? psp->state - states : -1);
+	HASHINT (hash, psp->sx);
+	HASHINT (hash, psp->sy);
+    }
+
+    HASHINT (hash, viewplayer->powers[pw_invisibility]);
+
+    return hash;
+}
+
+
+static void R_CopyView (byte *dest, byte *src)
+{
+    int		y;
+    int		ofs;
+
+    for (y=0 ; y<scaledviewheight ; y++)
+    {
+	ofs = (viewwindowy + y)*SCREENWIDTH + viewwindowx;
+	memcpy (dest + ofs, src + ofs, scaledviewwidth);
+    }
+}
+
+
+//
+// R_ReuseView
+// Copies back the last frame if nothing it was
+//  drawn from has changed since.
+//
+static bool R_ReuseView (void)
+{
+    if (!lastviewvalid || R_ViewHash (fuzzpos) != lastviewhash)
+	return false;
+
+    R_CopyView (I_VideoBuffer, lastview);
+    return true;
+}
+
+
+static void R_KeepView (int startfuzzpos)
+{
+    if (lastview == NULL)
+	lastview = Z_Malloc (SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);
+
+    R_CopyView (lastview, I_VideoBuffer);
+    lastviewhash = R_ViewHash (startfuzzpos);
+    lastviewvalid = true;
+}
+
+
+//
+// R_ClearLastView
+// Called by P_SetupLevel.
+//
+void R_ClearLastView (void)
+{
+    lastviewvalid = false;
+    numviewsubsectors = 0;
+}
+
+
+
+//
+// R_RenderStrip
+// Every strip walks the whole BSP, so that walls and planes
+//  are split into the same ranges as on a single thread,
+//  but only draws its own columns.
+//
+static int		numstrips;
+static int		framefuzzpos;
+static int		endfuzzpos;
+
+static void R_RenderStrip (void *unused, int strip)
+{
+    stripx1 = viewwidth*strip/numstrips;
+    stripx2 = viewwidth*(strip+1)/numstrips - 1;
+
+    // per thread state set up by R_SetupFrame
+    //  and R_ExecuteSetViewSize
+    colfunc = basecolfunc;
+    fuzzpos = framefuzzpos;
+
+    if (fixedcolormap)
+	walllights = scalelightfixed;
+
+    R_ClearClipSegs ();
+    R_ClearDrawSegs ();
+    R_ClearPlanes ();
+    R_ClearSprites ();
+
+    R_RenderBSPNode (numnodes-1);
+
+    if (reuseview)
+	R_MergeViewSubsectors ();
+
+    R_DrawPlanes ();
+    R_DrawMasked ();
+
+    if (rstats)
+	R_UpdateStats ();
+
+    // every strip steps the fuzz the same way
+    if (strip == 0)
+	endfuzzpos = fuzzpos;
+}
+
+
 //
 // R_RenderView
 //
 void R_RenderPlayerView (player_t* player)
 {	
+    int		startfuzzpos;
+
     R_SetupFrame (player);
 
+    if (reuseview)
+    {
+	if (R_ReuseView ())
+	{
+	    // Check for new console commands.
+	    NetUpdate ();
+	    return;
+	}
+
+	R_ClearViewSubsectors ();
+    }
+
+    startfuzzpos = fuzzpos;
+
+    if (rthreads > 1 && !deferdraw)
+    {
+	// check for new console commands.
+	NetUpdate ();
+
+	numstrips = rthreads < viewwidth ? rthreads : viewwidth;
+	framefuzzpos = fuzzpos;
+
+	R_PinCache ();
+	I_RunThreads (R_RenderStrip, NULL, numstrips);
+	R_UnpinCache ();
+
+	fuzzpos = endfuzzpos;
+
+	R_ScaleViewBuffer ();
+
+	if (reuseview)
+	    R_KeepView (startfuzzpos);
+
+	// Check for new console commands.
+	NetUpdate ();
+	return;
+    }
+
+    stripx1 = 0;
+    stripx2 = viewwidth-1;
+
+    if (deferdraw)
+    {
+	R_ClearDrawCommands (rthreads);
+	R_PinCache ();
+    }
+
     // Clear buffers.
     R_ClearClipSegs ();
     R_ClearDrawSegs ();
@@ -875,6 +1326,9 @@ void R_RenderPlayerView (player_t* player)
 
     // The head node is the last node output.
     R_RenderBSPNode (numnodes-1);
+
+    if (reuseview)
+	R_MergeViewSubsectors ();
     
     // Check for new console commands.
     NetUpdate ();
@@ -886,6 +1340,20 @@ void R_RenderPlayerView (player_t* player)
     
     R_DrawMasked ();
 
+    if (rstats)
+	R_UpdateStats ();
+
+    if (deferdraw)
+    {
+	R_RunDrawCommands ();
+	R_UnpinCache ();
+    }
+
+    R_ScaleViewBuffer ();
+
+    if (reuseview)
+	R_KeepView (startfuzzpos);
+
     // Check for new console commands.
     NetUpdate ();				
 }
@@ -21,6 +21,7 @@
 #define __R_MAIN__
 
 #include "d_player.h"
+#include "i_thread.h"
 #include "r_data.h"
 
 
@@ -46,6 +47,8 @@ extern fixed_t		projection;
 
 extern int		validcount;
 
+extern int		framecount;
+
 extern int		linecount;
 extern int		loopcount;
 
@@ -84,17 +87,36 @@ extern lighttable_t*	fixedcolormap;
 //  0 = high, 1 = low
 extern	int		detailshift;	
 
+// Render the view at the output resolution.
+extern	bool		nativeres;
+
+// Number of render threads, and the columns
+//  drawn by the current one.
+extern	int		rthreads;
+extern	THREAD_LOCAL int	stripx1;
+extern	THREAD_LOCAL int	stripx2;
+
+// Record column and span draws, and run them afterwards.
+extern	bool		deferdraw;
+
+// Print the most of each render pool used in a frame on exit.
+extern	bool		rstats;
+
+// Copy back the last frame when nothing in the view changed.
+extern	bool		reuseview;
+
 
 //
 // Function pointers to switch refresh/drawing functions.
 // Used to select shadow mode etc.
 //
-extern void		(*colfunc) (void);
+extern THREAD_LOCAL void		(*colfunc) (void);
 extern void		(*transcolfunc) (void);
 extern void		(*basecolfunc) (void);
 extern void		(*fuzzcolfunc) (void);
 // No shadow effects on floors.
 extern void		(*spanfunc) (void);
+extern void		(*litspanfunc) (void);
 
 
 //
@@ -157,4 +179,8 @@ void R_Init (void);
 // Called by M_Responder.
 void R_SetViewSize (int blocks, int detail);
 
+// Called by R_Subsector and P_SetupLevel, see -reuseview.
+void R_MarkViewSubsector (int num);
+void R_ClearLastView (void);
+
 #endif
@@ -42,16 +42,31 @@ planefunction_t		ceilingfunc;
 //
 
 // Here comes the obnoxious "visplane".
-#define MAXVISPLANES	128
-visplane_t		visplanes[MAXVISPLANES];
-visplane_t*		lastvisplane;
-visplane_t*		floorplane;
-visplane_t*		ceilingplane;
-
-// ?
-#define MAXOPENINGS	SCREENWIDTH*64
-short			openings[MAXOPENINGS];
-short*			lastopening;
+// The pool starts at the original limit
+//  and doubles whenever a frame needs more.
+THREAD_LOCAL visplane_t*		visplanes;
+THREAD_LOCAL visplane_t*		lastvisplane;
+THREAD_LOCAL visplane_t*		floorplane;
+THREAD_LOCAL visplane_t*		ceilingplane;
+static THREAD_LOCAL int			maxvisplanes;
+
+// Visplanes made by R_FindPlane, chained by height,
+//  picnum and lightlevel. Split planes made by R_CheckPlane
+//  are left out, the scan this replaces never reached them.
+// Heights are whole map units, so only their integer part
+//  is hashed, and the top bits of a multiply mix the rest.
+#define VISPLANEHASHBITS	7
+#define VISPLANEHASH		(1<<VISPLANEHASHBITS)
+#define VisplaneHash(height, picnum, lightlevel) \
+    (((((unsigned) (height) >> FRACBITS) \
+       ^ (unsigned) (picnum) << 16 \
+       ^ (unsigned) (lightlevel) << 8) * 0x9e3779b1u) >> (32 - VISPLANEHASHBITS))
+static THREAD_LOCAL int			visplanehash[VISPLANEHASH];
+
+// Same for openings.
+THREAD_LOCAL short*			openings;
+THREAD_LOCAL short*			lastopening;
+static THREAD_LOCAL int			maxopenings;
 
 
 //
@@ -59,31 +74,168 @@ short*			lastopening;
 //  floorclip starts out SCREENHEIGHT
 //  ceilingclip starts out -1
 //
-short			floorclip[SCREENWIDTH];
-short			ceilingclip[SCREENWIDTH];
+THREAD_LOCAL short			floorclip[SCREENWIDTH];
+THREAD_LOCAL short			ceilingclip[SCREENWIDTH];
 
 //
 // spanstart holds the start of a plane span
 // initialized to 0 at start
 //
-int			spanstart[SCREENHEIGHT];
-int			spanstop[SCREENHEIGHT];
+THREAD_LOCAL int			spanstart[SCREENHEIGHT];
+THREAD_LOCAL int			spanstop[SCREENHEIGHT];
 
 //
 // texture mapping
 //
-lighttable_t**		planezlight;
-fixed_t			planeheight;
+THREAD_LOCAL lighttable_t**		planezlight;
+THREAD_LOCAL fixed_t			planeheight;
 
 fixed_t			yslope[SCREENHEIGHT];
 fixed_t			distscale[SCREENWIDTH];
-fixed_t			basexscale;
-fixed_t			baseyscale;
+THREAD_LOCAL fixed_t			basexscale;
+THREAD_LOCAL fixed_t			baseyscale;
+
+THREAD_LOCAL fixed_t			cachedheight[SCREENHEIGHT];
+THREAD_LOCAL fixed_t			cacheddistance[SCREENHEIGHT];
+THREAD_LOCAL fixed_t			cachedxstep[SCREENHEIGHT];
+THREAD_LOCAL fixed_t			cachedystep[SCREENHEIGHT];
+
+
+//
+// PRE-LIT FLATS (-litflats)
+// A flat with a colormap already applied, so that
+//  spans take one lookup per pixel instead of two.
+// Few flat and light combinations are in view at a time,
+//  so a small cache of them, dropping the least recently
+//  drawn, covers most spans.
+//
+
+// Colormaps in the COLORMAP lump, the last two being
+//  the invulnerability map and an unused black one.
+#define NUMLITMAPS	34
+#define FLATSIZE	(64*64)
+
+int			litflatbudget;
+
+typedef struct
+{
+    // flat*NUMLITMAPS + colormap, or -1
+    int		key;
+    int		lastframe;
+
+    // most recently drawn first
+    int		prev;
+    int		next;
+} litflat_t;
+
+static byte*		litflats;
+static litflat_t*	litflatinfo;
+static int		numlitflats;
+static int		litflathead;
+static int		litflattail;
+
+// Slot holding each key, or -1.
+static int*		litflatslot;
+
+static THREAD_LOCAL int*	threadlitframe;
+static THREAD_LOCAL byte**	threadlit;
+
+// The flat R_DrawPlanes is drawing.
+static THREAD_LOCAL int		planeflat;
+static THREAD_LOCAL byte*	planesource;
+
+
+//
+// R_CacheLitFlat
+// Must be called with the thread lock held.
+//
+static byte *R_CacheLitFlat (int key)
+{
+    litflat_t*	lit;
+    byte*	dest;
+    int		slot;
+    int		i;
+
+    slot = litflatslot[key];
+
+    if (slot < 0)
+    {
+	slot = litflattail;
+	lit = &litflatinfo[slot];
+
+	// every slot is drawn from this frame
+	if (lit->lastframe == framecount)
+	    return NULL;
+
+	if (lit->key >= 0)
+	    litflatslot[lit->key] = -1;
+
+	lit->key = key;
+	litflatslot[key] = slot;
+
+	dest = litflats + slot*FLATSIZE;
+
+	for (i=0 ; i<FLATSIZE ; i++)
+	    dest[i] = ds_colormap[planesource[i]];
+    }
+
+    lit = &litflatinfo[slot];
+    lit->lastframe = framecount;
 
-fixed_t			cachedheight[SCREENHEIGHT];
-fixed_t			cacheddistance[SCREENHEIGHT];
-fixed_t			cachedxstep[SCREENHEIGHT];
-fixed_t			cachedystep[SCREENHEIGHT];
+    if (slot != litflathead)
+    {
+	litflatinfo[lit->prev].next = lit->next;
+	if (lit->next >= 0)
+	    litflatinfo[lit->next].prev = lit->prev;
+	else
+	    litflattail = lit->prev;
+
+	lit->prev = -1;
+	lit->next = litflathead;
+	litflatinfo[litflathead].prev = slot;
+	litflathead = slot;
+    }
+
+    return litflats + slot*FLATSIZE;
+}
+
+
+//
+// R_GetLitFlat
+// Returns the flat being drawn under ds_colormap,
+//  or NULL if there is no room for it.
+//
+static byte *R_GetLitFlat (void)
+{
+    int		map;
+    int		key;
+
+    map = (ds_colormap - colormaps) / 256;
+
+    if (map < 0 || map >= NUMLITMAPS)
+	return NULL;
+
+    key = planeflat*NUMLITMAPS + map;
+
+    if (!threadlitframe)
+    {
+	threadlitframe = calloc (numflats*NUMLITMAPS, sizeof(*threadlitframe));
+	threadlit = calloc (numflats*NUMLITMAPS, sizeof(*threadlit));
+	if (!threadlitframe || !threadlit)
+	    I_Error ("R_GetLitFlat: out of memory");
+    }
+
+    // only take the lock once per flat and frame
+    if (threadlitframe[key] != framecount)
+    {
+	I_LockThreads ();
+	threadlit[key] = R_CacheLitFlat (key);
+	I_UnlockThreads ();
+	threadlitframe[key] = framecount;
+    }
+
+    return threadlit[key];
+}
 
 
 
@@ -93,7 +245,32 @@ fixed_t			cachedystep[SCREENHEIGHT];
 //
 void R_InitPlanes (void)
 {
-  // Doh!
+    int		i;
+
+    numlitflats = litflatbudget / FLATSIZE;
+
+    if (!numlitflats)
+	return;
+
+    litflats = malloc (numlitflats * FLATSIZE);
+    litflatinfo = malloc (numlitflats * sizeof(*litflatinfo));
+    litflatslot = malloc (numflats * NUMLITMAPS * sizeof(*litflatslot));
+    if (!litflats || !litflatinfo || !litflatslot)
+	I_Error ("R_InitPlanes: out of memory");
+
+    for (i=0 ; i<numflats*NUMLITMAPS ; i++)
+	litflatslot[i] = -1;
+
+    for (i=0 ; i<numlitflats ; i++)
+    {
+	litflatinfo[i].key = -1;
+	litflatinfo[i].lastframe = 0;
+	litflatinfo[i].prev = i-1;
+	litflatinfo[i].next = i+1 < numlitflats ? i+1 : -1;
+    }
+
+    litflathead = 0;
+    litflattail = numlitflats-1;
 }
 
 
@@ -131,6 +308,9 @@ R_MapPlane
     }
 #endif
 
+    if (x2 < stripx1 || x1 > stripx2)
+	return;
+
     if (planeheight != cachedheight[y])
     {
 	cachedheight[y] = planeheight;
@@ -166,11 +346,127 @@ R_MapPlane
     ds_x1 = x1;
     ds_x2 = x2;
 
+    // clip to the strip, keeping the texture
+    //  position of the whole span
+    if (ds_x1 < stripx1)
+    {
+	R_StepSpan (stripx1 - ds_x1);
+	ds_x1 = stripx1;
+    }
+
+    if (ds_x2 > stripx2)
+	ds_x2 = stripx2;
+
+    if (numlitflats)
+    {
+	ds_source = R_GetLitFlat ();
+
+	if (ds_source)
+	{
+	    litspanfunc ();
+	    return;
+	}
+
+	ds_source = planesource;
+    }
+
     // high or low detail
     spanfunc ();	
 }
 
 
+//
+// R_GrowVisplanes
+// Doubles the visplane pool.
+// Everything pointing into it is moved along.
+//
+static void R_GrowVisplanes (void)
+{
+    visplane_t*	old;
+    int		count;
+
+    old = visplanes;
+    count = lastvisplane - visplanes;
+
+    maxvisplanes = maxvisplanes ? maxvisplanes*2 : MAXVISPLANES;
+    visplanes = malloc (maxvisplanes * sizeof(*visplanes));
+    if (!visplanes)
+	I_Error ("R_GrowVisplanes: out of memory (%i visplanes)", maxvisplanes);
+
+    lastvisplane = visplanes + count;
+
+    if (old)
+    {
+	memcpy (visplanes, old, count * sizeof(*visplanes));
+
+	if (floorplane)
+	    floorplane = visplanes + (floorplane - old);
+	if (ceilingplane)
+	    ceilingplane = visplanes + (ceilingplane - old);
+
+	free (old);
+    }
+}
+
+
+static visplane_t *R_NewVisplane (void)
+{
+    if (lastvisplane - visplanes == maxvisplanes)
+	R_GrowVisplanes ();
+
+    return lastvisplane++;
+}
+
+
+//
+// R_CheckOpenings
+// Makes room for count more openings.
+// The drawsegs made so far point into the old ones.
+//
+void R_CheckOpenings (int count)
+{
+    short*	old;
+    int		used;
+    drawseg_t*	ds;
+
+    used = lastopening - openings;
+
+    if (used + count <= maxopenings)
+	return;
+
+    old = openings;
+
+    if (!maxopenings)
+	maxopenings = MAXOPENINGS;
+    while (used + count > maxopenings)
+	maxopenings *= 2;
+
+    openings = malloc (maxopenings * sizeof(*openings));
+    if (!openings)
+	I_Error ("R_CheckOpenings: out of memory (%i openings)", maxopenings);
+
+    lastopening = openings + used;
+
+    if (old)
+    {
+	memcpy (openings, old, used * sizeof(*openings));
+
+	for (ds=drawsegs ; ds<ds_p ; ds++)
+	{
+	    if (ds->maskedtexturecol)
+		ds->maskedtexturecol = openings + (ds->maskedtexturecol - old);
+	    if (ds->sprtopclip && ds->sprtopclip != screenheightarray)
+		ds->sprtopclip = openings + (ds->sprtopclip - old);
+	    if (ds->sprbottomclip && ds->sprbottomclip != negonearray)
+		ds->sprbottomclip = openings + (ds->sprbottomclip - old);
+	}
+
+	free (old);
+    }
+}
+
+
+
 //
 // R_ClearPlanes
 // At begining of frame.
@@ -189,6 +485,7 @@ void R_ClearPlanes (void)
 
     lastvisplane = visplanes;
     lastopening = openings;
+    memset (visplanehash, 0, sizeof(visplanehash));
     
     // texture calculation
     memset (cachedheight, 0, sizeof(cachedheight));
@@ -214,6 +511,8 @@ R_FindPlane
   int		lightlevel )
 {
     visplane_t*	check;
+    unsigned	hash;
+    int		i;
 	
     if (picnum == skyflatnum)
     {
@@ -221,24 +520,23 @@ R_FindPlane
 	lightlevel = 0;
     }
 	
-    for (check=visplanes; check<lastvisplane; check++)
+    hash = VisplaneHash (height, picnum, lightlevel);
+
+    for (i=visplanehash[hash] ; i ; i=check->hashnext)
     {
+	check = &visplanes[i-1];
+
 	if (height == check->height
 	    && picnum == check->picnum
 	    && lightlevel == check->lightlevel)
 	{
-	    break;
+	    return check;
 	}
     }
-    
-			
-    if (check < lastvisplane)
-	return check;
-		
-    if (lastvisplane - visplanes == MAXVISPLANES)
-	I_Error ("R_FindPlane: no more visplanes");
 		
-    lastvisplane++;
+    check = R_NewVisplane ();
+    check->hashnext = visplanehash[hash];
+    visplanehash[hash] = check - visplanes + 1;
 
     check->height = height;
     check->picnum = picnum;
@@ -266,6 +564,7 @@ R_CheckPlane
     int		unionl;
     int		unionh;
     int		x;
+    visplane_t*	newpl;
 	
     if (start < pl->minx)
     {
@@ -302,12 +601,17 @@ R_CheckPlane
 	return pl;		
     }
 	
-    // make a new visplane
-    lastvisplane->height = pl->height;
-    lastvisplane->picnum = pl->picnum;
-    lastvisplane->lightlevel = pl->lightlevel;
+    // make a new visplane,
+    //  growing the pool may move pl
+    x = pl - visplanes;
+    newpl = R_NewVisplane ();
+    pl = &visplanes[x];
+
+    newpl->height = pl->height;
+    newpl->picnum = pl->picnum;
+    newpl->lightlevel = pl->lightlevel;
     
-    pl = lastvisplane++;
+    pl = newpl;
     pl->minx = start;
     pl->maxx = stop;
 
@@ -366,24 +670,14 @@ void R_DrawPlanes (void)
     int			angle;
     int                 lumpnum;
 				
-#ifdef RANGECHECK
-    if (ds_p - drawsegs > MAXDRAWSEGS)
-	I_Error ("R_DrawPlanes: drawsegs overflow (%i)",
-		 ds_p - drawsegs);
-    
-    if (lastvisplane - visplanes > MAXVISPLANES)
-	I_Error ("R_DrawPlanes: visplane overflow (%i)",
-		 lastvisplane - visplanes);
-    
-    if (lastopening - openings > MAXOPENINGS)
-	I_Error ("R_DrawPlanes: opening overflow (%i)",
-		 lastopening - openings);
-#endif
-
     for (pl = visplanes ; pl < lastvisplane ; pl++)
     {
-	if (pl->minx > pl->maxx)
+	if (pl->minx > pl->maxx
+	    || pl->maxx < stripx1
+	    || pl->minx > stripx2)
+	{
 	    continue;
+	}
 
 	
 	// sky flat
@@ -397,7 +691,9 @@ void R_DrawPlanes (void)
 	    //  by INVUL inverse mapping.
 	    dc_colormap = colormaps;
 	    dc_texturemid = skytexturemid;
-	    for (x=pl->minx ; x <= pl->maxx ; x++)
+	    x = pl->minx > stripx1 ? pl->minx : stripx1;
+	    stop = pl->maxx < stripx2 ? pl->maxx : stripx2;
+	    for ( ; x <= stop ; x++)
 	    {
 		dc_yl = pl->top[x];
 		dc_yh = pl->bottom[x];
@@ -415,7 +711,9 @@ void R_DrawPlanes (void)
 	
 	// regular flat
         lumpnum = firstflat + flattranslation[pl->picnum];
-	ds_source = W_CacheLumpNum(lumpnum, PU_STATIC);
+	ds_source = R_CacheLumpNum(lumpnum, PU_STATIC);
+	planesource = ds_source;
+	planeflat = flattranslation[pl->picnum];
 	
 	planeheight = abs(pl->height-viewz);
 	light = (pl->lightlevel >> LIGHTSEGSHIFT)+extralight;
@@ -441,6 +739,6 @@ void R_DrawPlanes (void)
 			pl->bottom[x]);
 	}
 	
-        W_ReleaseLumpNum(lumpnum);
+        R_ReleaseLumpNum(lumpnum);
     }
 }
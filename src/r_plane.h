@@ -21,12 +21,20 @@
 #define __R_PLANE__
 
 
+#include "i_thread.h"
 #include "r_data.h"
 
 
 
 // Visplane related.
-extern  short*		lastopening;
+// Initial pool sizes, the limits of the original.
+#define MAXVISPLANES	128
+#define MAXOPENINGS	SCREENWIDTH*64
+
+extern THREAD_LOCAL  visplane_t*	visplanes;
+extern THREAD_LOCAL  visplane_t*	lastvisplane;
+extern THREAD_LOCAL  short*		openings;
+extern THREAD_LOCAL  short*		lastopening;
 
 
 typedef void (*planefunction_t) (int top, int bottom);
@@ -34,15 +42,21 @@ typedef void (*planefunction_t) (int top, int bottom);
 extern planefunction_t	floorfunc;
 extern planefunction_t	ceilingfunc_t;
 
-extern short		floorclip[SCREENWIDTH];
-extern short		ceilingclip[SCREENWIDTH];
+extern THREAD_LOCAL short		floorclip[SCREENWIDTH];
+extern THREAD_LOCAL short		ceilingclip[SCREENWIDTH];
 
 extern fixed_t		yslope[SCREENHEIGHT];
 extern fixed_t		distscale[SCREENWIDTH];
 
+// Memory for pre-lit flats, see -litflats.
+extern int	litflatbudget;
+
 void R_InitPlanes (void);
 void R_ClearPlanes (void);
 
+// Grows the openings so that count more fit.
+void R_CheckOpenings (int count);
+
 void
 R_MapPlane
 ( int		y,
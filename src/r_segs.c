@@ -36,56 +36,56 @@
 // OPTIMIZE: closed two sided lines as single sided
 
 // True if any of the segs textures might be visible.
-bool		segtextured;	
+THREAD_LOCAL bool		segtextured;	
 
 // False if the back side is the same plane.
-bool		markfloor;	
-bool		markceiling;
+THREAD_LOCAL bool		markfloor;	
+THREAD_LOCAL bool		markceiling;
 
-bool		maskedtexture;
-int		toptexture;
-int		bottomtexture;
-int		midtexture;
+THREAD_LOCAL bool		maskedtexture;
+THREAD_LOCAL int		toptexture;
+THREAD_LOCAL int		bottomtexture;
+THREAD_LOCAL int		midtexture;
 
 
-angle_t		rw_normalangle;
+THREAD_LOCAL angle_t		rw_normalangle;
 // angle to line origin
-int		rw_angle1;	
+THREAD_LOCAL int		rw_angle1;	
 
 //
 // regular wall
 //
-int		rw_x;
-int		rw_stopx;
-angle_t		rw_centerangle;
-fixed_t		rw_offset;
-fixed_t		rw_distance;
-fixed_t		rw_scale;
-fixed_t		rw_scalestep;
-fixed_t		rw_midtexturemid;
-fixed_t		rw_toptexturemid;
-fixed_t		rw_bottomtexturemid;
+THREAD_LOCAL int		rw_x;
+THREAD_LOCAL int		rw_stopx;
+THREAD_LOCAL angle_t		rw_centerangle;
+THREAD_LOCAL fixed_t		rw_offset;
+THREAD_LOCAL fixed_t		rw_distance;
+THREAD_LOCAL fixed_t		rw_scale;
+THREAD_LOCAL fixed_t		rw_scalestep;
+THREAD_LOCAL fixed_t		rw_midtexturemid;
+THREAD_LOCAL fixed_t		rw_toptexturemid;
+THREAD_LOCAL fixed_t		rw_bottomtexturemid;
 
-int		worldtop;
-int		worldbottom;
-int		worldhigh;
-int		worldlow;
+THREAD_LOCAL int		worldtop;
+THREAD_LOCAL int		worldbottom;
+THREAD_LOCAL int		worldhigh;
+THREAD_LOCAL int		worldlow;
 
-fixed_t		pixhigh;
-fixed_t		pixlow;
-fixed_t		pixhighstep;
-fixed_t		pixlowstep;
+THREAD_LOCAL fixed_t		pixhigh;
+THREAD_LOCAL fixed_t		pixlow;
+THREAD_LOCAL fixed_t		pixhighstep;
+THREAD_LOCAL fixed_t		pixlowstep;
 
-fixed_t		topfrac;
-fixed_t		topstep;
+THREAD_LOCAL fixed_t		topfrac;
+THREAD_LOCAL fixed_t		topstep;
 
-fixed_t		bottomfrac;
-fixed_t		bottomstep;
+THREAD_LOCAL fixed_t		bottomfrac;
+THREAD_LOCAL fixed_t		bottomstep;
 
 
-lighttable_t**	walllights;
+THREAD_LOCAL lighttable_t**	walllights;
 
-short*		maskedtexturecol;
+THREAD_LOCAL short*		maskedtexturecol;
 
 
 
@@ -128,6 +128,12 @@ R_RenderMaskedSegRange
 
     maskedtexturecol = ds->maskedtexturecol;
 
+    // clip to the strip
+    if (x1 < stripx1)
+	x1 = stripx1;
+    if (x2 > stripx2)
+	x2 = stripx2;
+
     rw_scalestep = ds->scalestep;		
     spryscale = ds->scale1 + (x1 - ds->x1)*rw_scalestep;
     mfloorclip = ds->sprbottomclip;
@@ -206,9 +212,14 @@ void R_RenderSegLoop (void)
     fixed_t		texturecolumn;
     int			top;
     int			bottom;
+    bool		draw;
 
     for ( ; rw_x < rw_stopx ; rw_x++)
     {
+	// columns of other strips are only clipped and marked,
+	//  as spans starting there may reach this one
+	draw = rw_x >= stripx1 && rw_x <= stripx2;
+
 	// mark floor / ceiling areas
 	yl = (topfrac+HEIGHTUNIT-1)>>HEIGHTBITS;
 
@@ -250,7 +261,7 @@ void R_RenderSegLoop (void)
 	}
 	
 	// texturecolumn and lighting are independent of wall tiers
-	if (segtextured)
+	if (segtextured && draw)
 	{
 	    // calculate texture offset
 	    angle = (rw_centerangle + xtoviewangle[rw_x])>>ANGLETOFINESHIFT;
@@ -280,8 +291,11 @@ void R_RenderSegLoop (void)
 	    dc_yl = yl;
 	    dc_yh = yh;
 	    dc_texturemid = rw_midtexturemid;
-	    dc_source = R_GetColumn(midtexture,texturecolumn);
-	    colfunc ();
+	    if (draw)
+	    {
+		dc_source = R_GetColumn(midtexture,texturecolumn);
+		colfunc ();
+	    }
 	    ceilingclip[rw_x] = viewheight;
 	    floorclip[rw_x] = -1;
 	}
@@ -302,8 +316,11 @@ void R_RenderSegLoop (void)
 		    dc_yl = yl;
 		    dc_yh = mid;
 		    dc_texturemid = rw_toptexturemid;
-		    dc_source = R_GetColumn(toptexture,texturecolumn);
-		    colfunc ();
+		    if (draw)
+		    {
+			dc_source = R_GetColumn(toptexture,texturecolumn);
+			colfunc ();
+		    }
 		    ceilingclip[rw_x] = mid;
 		}
 		else
@@ -331,9 +348,12 @@ void R_RenderSegLoop (void)
 		    dc_yl = mid;
 		    dc_yh = yh;
 		    dc_texturemid = rw_bottomtexturemid;
-		    dc_source = R_GetColumn(bottomtexture,
-					    texturecolumn);
-		    colfunc ();
+		    if (draw)
+		    {
+			dc_source = R_GetColumn(bottomtexture,
+						texturecolumn);
+			colfunc ();
+		    }
 		    floorclip[rw_x] = mid;
 		}
 		else
@@ -379,20 +399,23 @@ R_StoreWallRange
     fixed_t		vtop;
     int			lightnum;
 
-    // don't overflow and crash
-    if (ds_p == &drawsegs[MAXDRAWSEGS])
-	return;		
-		
 #ifdef RANGECHECK
     if (start >=viewwidth || start > stop)
 	I_Error ("Bad R_RenderWallRange: %i to %i", start , stop);
 #endif
+
+    // room for the drawseg, and for the masked texture
+    //  columns and both sprite clips it may need
+    R_CheckDrawSegs ();
+    R_CheckOpenings (3*(stop-start+1));
     
     sidedef = curline->sidedef;
     linedef = curline->linedef;
 
-    // mark the segment as visible for auto map
-    linedef->flags |= ML_MAPPED;
+    // mark the segment as visible for auto map,
+    //  from one strip only as every strip sees it
+    if (stripx1 == 0)
+	linedef->flags |= ML_MAPPED;
     
     // calculate rw_distance for scale calculation
     rw_normalangle = curline->angle + ANG90;
@@ -22,6 +22,7 @@
 
 // Need data structure definitions.
 #include "d_player.h"
+#include "i_thread.h"
 #include "r_data.h"
 
 
@@ -48,8 +49,11 @@ extern lighttable_t*	colormaps;
 extern int		viewwidth;
 extern int		scaledviewwidth;
 extern int		viewheight;
+extern int		scaledviewheight;
+extern int		viewscale;
 
 extern int		firstflat;
+extern int		numflats;
 
 // for global animation
 extern int*		flattranslation;	
@@ -109,19 +113,19 @@ extern int		viewangletox[FINEANGLES/2];
 extern angle_t		xtoviewangle[SCREENWIDTH+1];
 //extern fixed_t		finetangent[FINEANGLES/2];
 
-extern fixed_t		rw_distance;
-extern angle_t		rw_normalangle;
+extern THREAD_LOCAL fixed_t		rw_distance;
+extern THREAD_LOCAL angle_t		rw_normalangle;
 
 
 
 // angle to line origin
-extern int		rw_angle1;
+extern THREAD_LOCAL int		rw_angle1;
 
 // Segs count?
-extern int		sscount;
+extern THREAD_LOCAL int		sscount;
 
-extern visplane_t*	floorplane;
-extern visplane_t*	ceilingplane;
+extern THREAD_LOCAL visplane_t*	floorplane;
+extern THREAD_LOCAL visplane_t*	ceilingplane;
 
 
 #endif
@@ -68,7 +68,7 @@ typedef struct
 fixed_t		pspritescale;
 fixed_t		pspriteiscale;
 
-lighttable_t**	spritelights;
+THREAD_LOCAL lighttable_t**	spritelights;
 
 // constant arrays
 //  used for psprite clipping and initializing clipping
@@ -278,10 +278,19 @@ void R_InitSpriteDefs (char** namelist)
 //
 // GAME FUNCTIONS
 //
-vissprite_t	vissprites[MAXVISSPRITES];
-vissprite_t*	vissprite_p;
+THREAD_LOCAL vissprite_t*	vissprites;
+THREAD_LOCAL vissprite_t*	vissprite_p;
+static THREAD_LOCAL int		maxvissprites;
 int		newvissprite;
 
+// Sectors whose sprites the current strip has added,
+//  as sector_t validcount is shared by all strips.
+// A thread may render several strips in one frame,
+//  so each strip gets its own stamp.
+static THREAD_LOCAL int*	spritesectors;
+static THREAD_LOCAL int		numspritesectors;
+static THREAD_LOCAL int		spritestamp;
+
 
 
 //
@@ -309,18 +318,43 @@ void R_InitSprites (char** namelist)
 void R_ClearSprites (void)
 {
     vissprite_p = vissprites;
+
+    if (rthreads > 1 && numspritesectors < numsectors)
+    {
+	spritesectors = realloc (spritesectors,
+				 numsectors * sizeof(*spritesectors));
+	if (!spritesectors)
+	    I_Error ("R_ClearSprites: out of memory");
+
+	memset (spritesectors + numspritesectors, 0,
+		(numsectors - numspritesectors) * sizeof(*spritesectors));
+	numspritesectors = numsectors;
+    }
+
+    spritestamp++;
 }
 
 
 //
 // R_NewVisSprite
+// The pool doubles when full.
 //
-vissprite_t	overflowsprite;
-
 vissprite_t* R_NewVisSprite (void)
 {
-    if (vissprite_p == &vissprites[MAXVISSPRITES])
-	return &overflowsprite;
+    int		count;
+
+    count = vissprite_p - vissprites;
+
+    if (count == maxvissprites)
+    {
+	maxvissprites = maxvissprites ? maxvissprites*2 : MAXVISSPRITES;
+	vissprites = realloc (vissprites, maxvissprites * sizeof(*vissprites));
+	if (!vissprites)
+	    I_Error ("R_NewVisSprite: out of memory (%i vissprites)",
+		     maxvissprites);
+
+	vissprite_p = vissprites + count;
+    }
 
     vissprite_p++;
     return vissprite_p-1;
@@ -334,11 +368,11 @@ vissprite_t* R_NewVisSprite (void)
 // Masked means: partly transparent, i.e. stored
 //  in posts/runs of opaque pixels.
 //
-short*		mfloorclip;
-short*		mceilingclip;
+THREAD_LOCAL short*		mfloorclip;
+THREAD_LOCAL short*		mceilingclip;
 
-fixed_t		spryscale;
-fixed_t		sprtopscreen;
+THREAD_LOCAL fixed_t		spryscale;
+THREAD_LOCAL fixed_t		sprtopscreen;
 
 void R_DrawMaskedColumn (column_t* column)
 {
@@ -371,7 +405,10 @@ void R_DrawMaskedColumn (column_t* column)
 
 	    // Drawn by either R_DrawColumn
 	    //  or (SHADOW) R_DrawFuzzColumn.
-	    colfunc ();
+	    if (dc_x >= stripx1 && dc_x <= stripx2)
+		colfunc ();
+	    else if (colfunc == fuzzcolfunc)
+		R_SkipFuzzColumn ();
 	}
 	column = (column_t *)(  (byte *)column + column->length + 4);
     }
@@ -397,7 +434,7 @@ R_DrawVisSprite
     patch_t*		patch;
 
 
-    patch = W_CacheLumpNum (vis->patch+firstspritelump, PU_CACHE);
+    patch = R_CacheLumpNum (vis->patch+firstspritelump, PU_CACHE);
 
     dc_colormap = vis->colormap;
 
@@ -419,7 +456,23 @@ R_DrawVisSprite
     spryscale = vis->scale;
     sprtopscreen = centeryfrac - FixedMul(dc_texturemid,spryscale);
 
-    for (dc_x=vis->x1 ; dc_x<=vis->x2 ; dc_x++, frac += vis->xiscale)
+    // clip to the strip, unless the fuzz
+    //  has to be stepped over other strips
+    x1 = vis->x1;
+    x2 = vis->x2;
+
+    if (colfunc != fuzzcolfunc)
+    {
+	if (x1 < stripx1)
+	{
+	    frac += vis->xiscale*(stripx1-x1);
+	    x1 = stripx1;
+	}
+	if (x2 > stripx2)
+	    x2 = stripx2;
+    }
+
+    for (dc_x=x1 ; dc_x<=x2 ; dc_x++, frac += vis->xiscale)
     {
 	texturecolumn = frac>>FRACBITS;
 #ifdef RANGECHECK
@@ -611,11 +664,22 @@ void R_AddSprites (sector_t* sec)
     // A sector might have been split into several
     //  subsectors during BSP building.
     // Thus we check whether its already added.
-    if (sec->validcount == validcount)
-	return;
+    if (rthreads > 1)
+    {
+	// every strip adds its own sprites
+	if (spritesectors[sec-sectors] == spritestamp)
+	    return;
 
-    // Well, now it will be done.
-    sec->validcount = validcount;
+	spritesectors[sec-sectors] = spritestamp;
+    }
+    else
+    {
+	if (sec->validcount == validcount)
+	    return;
+
+	// Well, now it will be done.
+	sec->validcount = validcount;
+    }
 
     lightnum = (sec->lightlevel >> LIGHTSEGSHIFT)+extralight;
 
@@ -772,8 +836,76 @@ void R_DrawPlayerSprites (void)
 
 //
 // R_SortVisSprites
+// Orders the vissprites by increasing scale,
+//  keeping sprites of equal scale in the order
+//  they were added, so far ones are drawn first.
+//
+THREAD_LOCAL vissprite_t	vsprsortedhead;
+
+static THREAD_LOCAL vissprite_t**	vsprsort;
+static THREAD_LOCAL vissprite_t**	vsprsorttemp;
+static THREAD_LOCAL int			maxvsprsort;
+
+
+//
+// R_MergeSortVisSprites
+// Stable sort of count vissprites,
+//  temp has room for as many.
 //
-vissprite_t	vsprsortedhead;
+static void
+R_MergeSortVisSprites
+( vissprite_t**	list,
+  vissprite_t**	temp,
+  int		count )
+{
+    vissprite_t**	a;
+    vissprite_t**	b;
+    vissprite_t**	aend;
+    vissprite_t**	bend;
+    vissprite_t**	dest;
+    vissprite_t*	spr;
+    int			i;
+    int			j;
+
+    // insertion sort for short runs
+    if (count < 16)
+    {
+	for (i=1 ; i<count ; i++)
+	{
+	    spr = list[i];
+
+	    for (j=i ; j>0 && list[j-1]->scale > spr->scale ; j--)
+		list[j] = list[j-1];
+
+	    list[j] = spr;
+	}
+	return;
+    }
+
+    a = list;
+    aend = b = list + count/2;
+    bend = list + count;
+
+    R_MergeSortVisSprites (a, temp, aend - a);
+    R_MergeSortVisSprites (b, temp, bend - b);
+
+    // take from the first half on ties
+    dest = temp;
+
+    while (a < aend && b < bend)
+    {
+	if (b[0]->scale < a[0]->scale)
+	    *dest++ = *b++;
+	else
+	    *dest++ = *a++;
+    }
+
+    while (a < aend)
+	*dest++ = *a++;
+
+    // the rest of the second half is already in place
+    memcpy (list, temp, (dest - temp) * sizeof(*list));
+}
 
 
 void R_SortVisSprites (void)
@@ -781,49 +913,35 @@ void R_SortVisSprites (void)
     int			i;
     int			count;
     vissprite_t*	ds;
-    vissprite_t*	best;
-    vissprite_t		unsorted;
-    fixed_t		bestscale;
 
     count = vissprite_p - vissprites;
 
-    unsorted.next = unsorted.prev = &unsorted;
+    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
 
     if (!count)
 	return;
 
-    for (ds=vissprites ; ds<vissprite_p ; ds++)
+    if (count > maxvsprsort)
     {
-	ds->next = ds+1;
-	ds->prev = ds-1;
+	maxvsprsort = count*2;
+	vsprsort = realloc (vsprsort, maxvsprsort * sizeof(*vsprsort));
+	vsprsorttemp = realloc (vsprsorttemp, maxvsprsort * sizeof(*vsprsorttemp));
+	if (!vsprsort || !vsprsorttemp)
+	    I_Error ("R_SortVisSprites: out of memory");
     }
 
-    vissprites[0].prev = &unsorted;
-    unsorted.next = &vissprites[0];
-    (vissprite_p-1)->next = &unsorted;
-    unsorted.prev = vissprite_p-1;
+    for (i=0 ; i<count ; i++)
+	vsprsort[i] = &vissprites[i];
 
-    // pull the vissprites out by scale
+    R_MergeSortVisSprites (vsprsort, vsprsorttemp, count);
 
-    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
     for (i=0 ; i<count ; i++)
     {
-	bestscale = INT_MAX;
-        best = unsorted.next;
-	for (ds=unsorted.next ; ds!= &unsorted ; ds=ds->next)
-	{
-	    if (ds->scale < bestscale)
-	    {
-		bestscale = ds->scale;
-		best = ds;
-	    }
-	}
-	best->next->prev = best->prev;
-	best->prev->next = best->next;
-	best->next = &vsprsortedhead;
-	best->prev = vsprsortedhead.prev;
-	vsprsortedhead.prev->next = best;
-	vsprsortedhead.prev = best;
+	ds = vsprsort[i];
+	ds->next = &vsprsortedhead;
+	ds->prev = vsprsortedhead.prev;
+	vsprsortedhead.prev->next = ds;
+	vsprsortedhead.prev = ds;
     }
 }
 
@@ -832,8 +950,8 @@ void R_SortVisSprites (void)
 //
 // R_DrawSprite
 //
-static short		clipbot[SCREENWIDTH];
-static short		cliptop[SCREENWIDTH];
+static THREAD_LOCAL short	clipbot[SCREENWIDTH];
+static THREAD_LOCAL short	cliptop[SCREENWIDTH];
 void R_DrawSprite (vissprite_t* spr)
 {
     drawseg_t*		ds;
@@ -962,6 +1080,12 @@ void R_DrawMasked (void)
 	     spr != &vsprsortedhead ;
 	     spr=spr->next)
 	{
+	    // only shadows are drawn outside the strip
+	    if ((spr->x2 < stripx1 || spr->x1 > stripx2)
+		&& spr->colormap)
+	    {
+		continue;
+	    }
 
 	    R_DrawSprite (spr);
 	}
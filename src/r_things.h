@@ -20,13 +20,16 @@
 #ifndef __R_THINGS__
 #define __R_THINGS__
 
+#include "i_thread.h"
 
 
+
+// Initial size of the vissprite pool.
 #define MAXVISSPRITES  	128
 
-extern vissprite_t	vissprites[MAXVISSPRITES];
-extern vissprite_t*	vissprite_p;
-extern vissprite_t	vsprsortedhead;
+extern THREAD_LOCAL vissprite_t*	vissprites;
+extern THREAD_LOCAL vissprite_t*	vissprite_p;
+extern THREAD_LOCAL vissprite_t	vsprsortedhead;
 
 // Constant arrays used for psprite clipping
 //  and initializing clipping.
@@ -34,10 +37,10 @@ extern short		negonearray[SCREENWIDTH];
 extern short		screenheightarray[SCREENWIDTH];
 
 // vars for R_DrawMaskedColumn
-extern short*		mfloorclip;
-extern short*		mceilingclip;
-extern fixed_t		spryscale;
-extern fixed_t		sprtopscreen;
+extern THREAD_LOCAL short*		mfloorclip;
+extern THREAD_LOCAL short*		mceilingclip;
+extern THREAD_LOCAL fixed_t		spryscale;
+extern THREAD_LOCAL fixed_t		sprtopscreen;
 
 extern fixed_t		pspritescale;
 extern fixed_t		pspriteiscale;
@@ -17,8 +17,13 @@
 //
 
 
+#include <signal.h>
+#include <string.h>
+
 #include "z_zone.h"
 #include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
 #include "doomtype.h"
 
 
@@ -44,6 +49,13 @@ typedef struct memblock_s
     int			id;	// should be ZONEID
     struct memblock_s*	next;
     struct memblock_s*	prev;
+
+    // with -zindex, the free list of its size
+    //  or the list of purgable blocks,
+    //  with -zarena, the strays of a level arena,
+    //  with -zgrow, the next region
+    struct memblock_s*	listnext;
+    struct memblock_s*	listprev;
 } memblock_t;
 
 
@@ -64,115 +76,1078 @@ typedef struct
 memzone_t*	mainzone;
 
 
+//
+// SLAB POOLS
+// Mobjs and special thinkers are made and freed all
+//  through a level, a few sizes of them over and over.
+// They come from slabs, zone blocks holding a number of
+//  them, and the freed ones of each size and tag are kept
+//  on a list for the next, so neither takes a scan of the zone.
+// A slab has the tag of its objects, so that Z_FreeTags
+//  frees it along with the rest of the level.
+//
+// Each object has a header like a zone block, with SLABID
+//  for an id, so that Z_Free can tell them apart.
+//
+
+#define SLABID		0x1d4a12
+#define SLABOBJECTS	32
+#define MAXSLABPOOLS	16
+
+typedef struct
+{
+    int			size;	// of an object, including the header
+    int			tag;
+    memblock_t*		freelist;
+} slabpool_t;
+
+static slabpool_t	slabpools[MAXSLABPOOLS];
+static int		numslabpools;
+
+
+//
+// FREE BLOCK INDEX (-zindex)
+// Finding a free block by scanning from the rover takes
+//  longer the more blocks there are in the zone.
+// Instead, free blocks are kept on lists by size, four to
+//  each power of two, and the first block on a list of
+//  larger sizes than asked for is taken.
+// When none is free, purgable blocks are thrown out
+//  oldest first, rather than those after the rover.
+//
+
+#define NUMBINS		128
+
+static bool		zoneindex;
+static memblock_t*	freebins[NUMBINS];
+
+// Which lists have blocks on them.
+static unsigned int	freebinmap[NUMBINS/32];
+
+// Purgable blocks, from the oldest.
+static memblock_t	purgecap;
+
+
+//
+// LEVEL ARENAS (-zarena)
+// Freeing a level block by block with Z_FreeTags walks
+//  the whole zone and merges each block with its neighbours.
+// Instead, blocks tagged PU_LEVEL or PU_LEVSPEC without
+//  a user are cut one after another from large chunks of
+//  the zone, one arena of chunks for each tag, and the
+//  chunks are freed together at the end of the level.
+// Blocks freed during the level go on lists of the arena by
+//  size, like the free lists of -zindex, and a later block
+//  takes the first one on the list of its size if it fits,
+//  so that a reused block is less than a quarter larger.
+//
+// Level blocks with a user, such as lumps, and blocks
+//  changed to a level tag stay in the zone, on a list of
+//  strays of the arena, which is freed along with it.
+//
+
+#define ARENAID		0x1d4a13
+#define ARENACHUNK	(64*1024)
+#define NUMARENAS	(PU_LEVSPEC - PU_LEVEL + 1)
+
+typedef struct
+{
+    // chunks from the zone, chained through their start
+    void*		chunks;
+
+    // the rest of the last chunk
+    byte*		top;
+    byte*		end;
+
+    // blocks freed since, by size, chained through next
+    memblock_t*		freelists[NUMBINS];
+
+    // cap for level blocks in the zone
+    memblock_t		strays;
+} arena_t;
+
+static bool		zonearena;
+static arena_t		arenas[NUMARENAS];
+
+
+//
+// ZONE REGIONS (-zgrow)
+// Rather than failing when full, the zone can take more
+//  memory from the system, as regions after the first one
+//  in the block list.
+// Each region starts with a block marking it, which is never
+//  free, so that the blocks of two regions are never merged.
+// When all of a region added this way is free at the end
+//  of a level, its pages are given back to the system.
+// Not as soon as it is free, as a block made and freed over
+//  and over in it would fault the pages in again each time.
+//
+
+#define REGIONID	0x1d4a14
+#define ZONEREGION	(4*1024*1024)
+
+static bool		zonegrow;
+
+// The blocks marking the added regions, chained through listnext.
+static memblock_t*	zoneregions;
+
+
+//
+// STATISTICS (-zstats)
+// Counted for each tag all the time, and written to a file
+//  at exit, or on SIGUSR1 where there is one.
+// Live bytes and blocks are of blocks in the zone, slabs
+//  and arena chunks among them. Objects are those cut from
+//  slabs and arenas, which Z_FreeTags frees without counting.
+// Frees of blocks include purges, where a purgable block is
+//  thrown out to make room.
+//
+
+typedef struct
+{
+    int			live;	// bytes, including headers
+    int			blocks;
+    uint64_t		mallocs;
+    uint64_t		frees;
+    uint64_t		purges;
+    uint64_t		objects;
+    uint64_t		objfrees;
+} zonestats_t;
+
+static zonestats_t	zonestats[PU_NUM_TAGS];
+
+// Blocks looked at while finding room for one,
+//  by the rover or on the free lists.
+static int		scansteps;
+static uint64_t		zonescans;
+static uint64_t		zonesteps;
+static int		longestscan;
+
+static char*		statsname;
+
+static volatile sig_atomic_t	zonesignal;
+
+
+//
+// TRACE (-ztrace)
+// Each malloc, free and change of tag is written to a file,
+//  after a header, as records in the native byte order:
+//
+//   header:  "ZTRACE\0\0", int32 record size
+//   record:  uint8 event, uint8 tag, uint16 file, int32 line,
+//            int32 size, uint32 time in ms, uint64 pointer
+//
+// Sizes include the block header. The first time a source file
+//  is seen, a ZT_FILE record gives it an index, and is followed
+//  by the size bytes of its name. Index 0 is no file.
+// A purge has the file and line of the malloc it made room for.
+// ZT_FREETAGS has the low tag for a size and the high tag for a
+//  tag, and frees all blocks and objects with a tag in between.
+// Records are buffered, and written out when the buffer is full,
+//  at exit, or on SIGUSR1.
+//
+
+enum
+{
+    ZT_FILE,
+    ZT_MALLOC,
+    ZT_FREE,
+    ZT_CHANGETAG,
+    ZT_PURGE,
+    ZT_FREETAGS,
+    ZT_OBJECT,		// from a slab or arena
+    ZT_OBJFREE
+};
+
+typedef struct
+{
+    uint8_t		event;
+    uint8_t		tag;
+    uint16_t		file;
+    int32_t		line;
+    int32_t		size;
+    uint32_t		time;
+    uint64_t		ptr;
+} zonetrace_t;
+
+#define TRACEBUFFER	(64*1024)
+#define MAXTRACEFILES	1024
+
+static FILE*		tracefile;
+static byte		tracebuf[TRACEBUFFER];
+static int		tracelen;
+
+static char*		tracefiles[MAXTRACEFILES];
+static int		numtracefiles;
+
+// the malloc purges are made for
+static char*		purgefile;
+static int		purgeline;
+
+
+
+//
+// Z_SizeBin
+// Which list a free block of the given size goes on.
+//
+static int Z_SizeBin (unsigned int size)
+{
+    int		bits;
+
+#ifdef __GNUC__
+    bits = 31 - __builtin_clz (size);
+#else
+    for (bits = 2 ; (size >> bits) > 1 ; bits++)
+	;
+#endif
+
+    return bits*4 + ((size >> (bits-2)) & 3) - 8;
+}
+
+
+//
+// Z_NextBin
+// The first list from bin on with blocks on it, or NUMBINS.
+//
+static int Z_NextBin (int bin)
+{
+    unsigned int	bits;
+    int			i;
+
+    i = bin / 32;
+    bits = freebinmap[i] & (~0u << (bin % 32));
+
+    while (!bits)
+    {
+	if (++i == NUMBINS/32)
+	    return NUMBINS;
+	bits = freebinmap[i];
+    }
+
+#ifdef __GNUC__
+    return i*32 + __builtin_ctz (bits);
+#else
+    for (bin = i*32 ; !(bits & 1) ; bits >>= 1)
+	bin++;
+    return bin;
+#endif
+}
+
+
+static void Z_LinkFree (memblock_t* block)
+{
+    int		bin;
+
+    bin = Z_SizeBin (block->size);
+
+    block->listprev = NULL;
+    block->listnext = freebins[bin];
+    if (block->listnext)
+	block->listnext->listprev = block;
+    freebins[bin] = block;
+    freebinmap[bin / 32] |= 1u << (bin % 32);
+}
+
+
+static void Z_UnlinkFree (memblock_t* block)
+{
+    int		bin;
+
+    if (block->listprev)
+	block->listprev->listnext = block->listnext;
+    else
+    {
+	bin = Z_SizeBin (block->size);
+	freebins[bin] = block->listnext;
+	if (!freebins[bin])
+	    freebinmap[bin / 32] &= ~(1u << (bin % 32));
+    }
+
+    if (block->listnext)
+	block->listnext->listprev = block->listprev;
+}
+
+
+static void Z_LinkList (memblock_t* cap, memblock_t* block)
+{
+    block->listnext = cap;
+    block->listprev = cap->listprev;
+    cap->listprev->listnext = block;
+    cap->listprev = block;
+}
+
+
+static void Z_UnlinkList (memblock_t* block)
+{
+    block->listprev->listnext = block->listnext;
+    block->listnext->listprev = block->listprev;
+}
+
+
+//
+// Z_TagList
+// The list a zone block with the given tag goes on, if any.
+//
+static memblock_t *Z_TagList (int tag)
+{
+    if (zoneindex && tag >= PU_PURGELEVEL)
+	return &purgecap;
+
+    if (zonearena && tag >= PU_LEVEL && tag <= PU_LEVSPEC)
+	return &arenas[tag - PU_LEVEL].strays;
+
+    return NULL;
+}
+
+
+//
+// Z_RegionStart
+// Whether the block marks the start of a region.
+//
+static bool Z_RegionStart (memblock_t* block)
+{
+    return block != &mainzone->blocklist && block->id == REGIONID;
+}
+
+
+//
+// Z_FindFree
+// Returns a free block of at least size bytes, or NULL.
+//
+static memblock_t *Z_FindFree (int size)
+{
+    memblock_t*	block;
+    int		bin;
+    int		next;
+
+    bin = Z_SizeBin (size);
+    next = Z_NextBin (bin + 1);
+
+    // any block on a later list is big enough
+    if (next < NUMBINS)
+    {
+	scansteps++;
+	return freebins[next];
+    }
+
+    // only then look through blocks of nearly the same size
+    for (block = freebins[bin] ; block ; block = block->listnext)
+    {
+	scansteps++;
+	if (block->size >= size)
+	    return block;
+    }
+
+    return NULL;
+}
+
+
+//
+// Z_CountScan
+// Adds the blocks looked at for a malloc to the statistics.
+//
+static void Z_CountScan (void)
+{
+    zonescans++;
+    zonesteps += scansteps;
+
+    if (scansteps > longestscan)
+	longestscan = scansteps;
+}
+
+
+//
+// Z_FlushTrace
+//
+static void Z_FlushTrace (void)
+{
+    if (tracelen)
+	fwrite (tracebuf, 1, tracelen, tracefile);
+
+    tracelen = 0;
+    fflush (tracefile);
+}
+
+
+static void Z_TraceWrite (void* data, int len)
+{
+    if (tracelen + len > TRACEBUFFER)
+	Z_FlushTrace ();
+
+    memcpy (tracebuf + tracelen, data, len);
+    tracelen += len;
+}
+
+
+//
+// Z_TraceFile
+// The index of a source file in the trace,
+//  naming it there the first time.
+//
+static int Z_TraceFile (char* file)
+{
+    zonetrace_t	rec;
+    int		i;
+
+    if (!file)
+	return 0;
+
+    for (i=0 ; i<numtracefiles ; i++)
+	if (tracefiles[i] == file)
+	    return i + 1;
+
+    if (numtracefiles == MAXTRACEFILES)
+	I_Error ("Z_TraceFile: more than %i source files", MAXTRACEFILES);
+
+    tracefiles[numtracefiles++] = file;
+
+    memset (&rec, 0, sizeof(rec));
+    rec.event = ZT_FILE;
+    rec.file = numtracefiles;
+    rec.size = strlen (file);
+    rec.time = I_GetTimeMS ();
+
+    Z_TraceWrite (&rec, sizeof(rec));
+    Z_TraceWrite (file, rec.size);
+
+    return numtracefiles;
+}
+
+
+//
+// Z_Trace
+// Records an event for the block, see TRACE.
+//
+static void
+Z_Trace
+( int		event,
+  memblock_t*	block,
+  int		size,
+  int		tag,
+  char*		file,
+  int		line )
+{
+    zonetrace_t	rec;
+
+    rec.event = event;
+    rec.tag = tag;
+    rec.file = Z_TraceFile (file);
+    rec.line = line;
+    rec.size = size;
+    rec.time = I_GetTimeMS ();
+    rec.ptr = block ? (uintptr_t) ((byte *)block + sizeof(memblock_t)) : 0;
+
+    Z_TraceWrite (&rec, sizeof(rec));
+}
+
+
+//
+// Z_WriteStats
+// Adds the statistics to the -zstats file.
+//
+static void Z_WriteStats (void)
+{
+    FILE*	f;
+
+    f = fopen (statsname, "a");
+
+    if (!f)
+	return;
+
+    fprintf (f, "Z_WriteStats: at %i ms\n", I_GetTimeMS ());
+    Z_FileDumpStats (f);
+    fprintf (f, "\n");
+    fclose (f);
+}
+
+
+//
+// Z_Report
+// Writes out the statistics and trace after a SIGUSR1,
+//  once the zone is in one piece.
+//
+static void Z_Report (void)
+{
+    zonesignal = 0;
+
+    if (statsname)
+	Z_WriteStats ();
+
+    if (tracefile)
+	Z_FlushTrace ();
+}
+
+
+#ifdef SIGUSR1
+static void Z_Signal (int sig)
+{
+    signal (sig, Z_Signal);
+    zonesignal = 1;
+}
+#endif
+
+
+//
+// Z_ClearZone
+//
+void Z_ClearZone (memzone_t* zone)
+{
+    memblock_t*		block;
+	
+    // set the entire zone to one free block
+    zone->blocklist.next =
+	zone->blocklist.prev =
+	block = (memblock_t *)( (byte *)zone + sizeof(memzone_t) );
+    
+    zone->blocklist.user = (void *)zone;
+    zone->blocklist.tag = PU_STATIC;
+    zone->rover = block;
+	
+    block->prev = block->next = &zone->blocklist;
+    
+    // a free block.
+    block->tag = PU_FREE;
+
+    block->size = zone->size - sizeof(memzone_t);
+}
+
+
+
+//
+// Z_Init
+//
+void Z_Init (void)
+{
+    memblock_t*	block;
+    int		size;
+    int		i;
+    int		p;
+
+    mainzone = (memzone_t *)I_ZoneBase (&size);
+    mainzone->size = size;
+
+    // set the entire zone to one free block
+    mainzone->blocklist.next =
+	mainzone->blocklist.prev =
+	block = (memblock_t *)( (byte *)mainzone + sizeof(memzone_t) );
+
+    mainzone->blocklist.user = (void *)mainzone;
+    mainzone->blocklist.tag = PU_STATIC;
+    mainzone->rover = block;
+	
+    block->prev = block->next = &mainzone->blocklist;
+
+    // free block
+    block->tag = PU_FREE;
+    
+    block->size = mainzone->size - sizeof(memzone_t);
+
+    //!
+    // Keep the free blocks of the zone on lists by size, and
+    // throw out the oldest purgable blocks first when full,
+    // instead of scanning through the zone for a large enough
+    // free block.
+    //
+
+    zoneindex = M_CheckParm ("-zindex") > 0;
+
+    if (zoneindex)
+    {
+        purgecap.listnext = purgecap.listprev = &purgecap;
+        Z_LinkFree (block);
+    }
+
+    //!
+    // Cut level data from large chunks of the zone, and free
+    // them all at once at the end of the level, instead of
+    // block by block.
+    //
+
+    zonearena = M_CheckParm ("-zarena") > 0;
+
+    for (i=0 ; i<NUMARENAS ; i++)
+        arenas[i].strays.listnext = arenas[i].strays.listprev = &arenas[i].strays;
+
+    //!
+    // When the zone is full, add another region of at least
+    // 4 MiB to it rather than exiting with an error. Regions
+    // that are unused at the end of a level are given back.
+    //
+
+    zonegrow = M_CheckParm ("-zgrow") > 0;
+
+    //!
+    // @arg <file>
+    //
+    // Append the allocations, frees and purges of each zone
+    // tag, how fragmented the zone is and how far it was
+    // searched for room to the given file, at exit and on
+    // SIGUSR1.
+    //
+
+    p = M_CheckParmWithArgs ("-zstats", 1);
+
+    if (p)
+    {
+        statsname = myargv[p+1];
+        I_AtExit (Z_WriteStats, true);
+    }
+
+    //!
+    // @arg <file>
+    //
+    // Write each zone malloc, free and change of tag, with the
+    // source file and line it was made from, to the given file,
+    // in the binary format described in z_zone.c.
+    //
+
+    p = M_CheckParmWithArgs ("-ztrace", 1);
+
+    if (p)
+    {
+        tracefile = fopen (myargv[p+1], "wb");
+
+        if (!tracefile)
+            I_Error ("Z_Init: could not open %s", myargv[p+1]);
+
+        fwrite ("ZTRACE\0\0", 1, 8, tracefile);
+        size = sizeof(zonetrace_t);
+        fwrite (&size, sizeof(size), 1, tracefile);
+
+        I_AtExit (Z_FlushTrace, true);
+    }
+
+#ifdef SIGUSR1
+    if (statsname || tracefile)
+        signal (SIGUSR1, Z_Signal);
+#endif
+}
+
+
+//
+// Z_FindSlabPool
+//
+static slabpool_t *Z_FindSlabPool (int size, int tag)
+{
+    slabpool_t*	pool;
+
+    for (pool = slabpools ; pool < slabpools + numslabpools ; pool++)
+	if (pool->size == size && pool->tag == tag)
+	    return pool;
+
+    return NULL;
+}
+
+
+//
+// Z_FreeSlab
+// Puts an object back on the list of its pool.
+// Only the header is written, as with zone blocks.
+//
+static void Z_FreeSlab (memblock_t* block)
+{
+    slabpool_t*	pool;
+
+    pool = Z_FindSlabPool (block->size, block->tag);
+
+    if (!pool)
+	I_Error ("Z_FreeSlab: no pool for the object");
+
+    block->id = 0;
+    block->next = pool->freelist;
+    pool->freelist = block;
+}
+
+
+//
+// Z_FreeArena
+// Keeps a level block for a later one, see LEVEL ARENAS.
+//
+static void Z_FreeArena (memblock_t* block)
+{
+    arena_t*	arena;
+    int		bin;
+
+    arena = &arenas[block->tag - PU_LEVEL];
+    bin = Z_SizeBin (block->size);
+
+    block->id = 0;
+    block->next = arena->freelists[bin];
+    arena->freelists[bin] = block;
+}
+
+
+//
+// Z_FreeBlock
+// Frees a block of the zone.
+//
+static void Z_FreeBlock (memblock_t* block)
+{
+    memblock_t*		other;
+
+    zonestats[block->tag].live -= block->size;
+    zonestats[block->tag].blocks--;
+    zonestats[block->tag].frees++;
+		
+    if (block->tag != PU_FREE && block->user != NULL)
+    {
+    	// clear the user's mark
+	    *block->user = 0;
+    }
+
+    if (block->tag != PU_FREE && Z_TagList (block->tag))
+	Z_UnlinkList (block);
+
+    // mark as free
+    block->tag = PU_FREE;
+    block->user = NULL;
+    block->id = 0;
+	
+    other = block->prev;
+
+    if (other->tag == PU_FREE)
+    {
+        if (zoneindex)
+            Z_UnlinkFree (other);
+
+        // merge with previous free block
+        other->size += block->size;
+        other->next = block->next;
+        other->next->prev = other;
+
+        if (block == mainzone->rover)
+            mainzone->rover = other;
+
+        block = other;
+    }
+	
+    other = block->next;
+    if (other->tag == PU_FREE)
+    {
+        if (zoneindex)
+            Z_UnlinkFree (other);
+
+        // merge the next free block onto the end
+        block->size += other->size;
+        block->next = other->next;
+        block->next->prev = block;
+
+        if (other == mainzone->rover)
+            mainzone->rover = block;
+    }
+
+    if (zoneindex)
+        Z_LinkFree (block);
+}
+
+
+//
+// Z_Free
+//
+void Z_Free2 (void* ptr, char* file, int line)
+{
+    memblock_t*		block;
+
+    if (zonesignal)
+	Z_Report ();
+	
+    block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
+
+    if (block->id == SLABID || block->id == ARENAID)
+    {
+	zonestats[block->tag].objfrees++;
+
+	if (tracefile)
+	    Z_Trace (ZT_OBJFREE, block, block->size, block->tag, file, line);
+
+	if (block->id == SLABID)
+	    Z_FreeSlab (block);
+	else
+	    Z_FreeArena (block);
+	return;
+    }
+
+    if (block->id != ZONEID)
+	I_Error ("%s:%i: Z_Free: freed a pointer without ZONEID", file, line);
+
+    if (tracefile)
+	Z_Trace (ZT_FREE, block, block->size, block->tag, file, line);
+
+    Z_FreeBlock (block);
+}
+
+
+//
+// Z_Purge
+// Throws out a purgable block to make room.
+//
+static void Z_Purge (memblock_t* block)
+{
+    zonestats[block->tag].purges++;
+
+    if (tracefile)
+	Z_Trace (ZT_PURGE, block, block->size, block->tag, purgefile, purgeline);
+
+    Z_FreeBlock (block);
+}
+
+
+
+//
+// Z_FindIndexed
+// Purges the oldest blocks until one fits,
+//  or returns NULL when there are none left.
+//
+static memblock_t *Z_FindIndexed (int size)
+{
+    memblock_t*	base;
+
+    base = Z_FindFree (size);
+
+    while (!base && purgecap.listnext != &purgecap)
+    {
+        scansteps++;
+        Z_Purge (purgecap.listnext);
+        base = Z_FindFree (size);
+    }
+
+    if (base)
+        Z_UnlinkFree (base);
+
+    return base;
+}
+
+
+//
+// Z_FindRover
+// Scans from the rover for the first free block
+//  of sufficient size, throwing out any purgable
+//  blocks along the way. NULL if there is none.
+//
+static memblock_t *Z_FindRover (int size)
+{
+    memblock_t*	start;
+    memblock_t* rover;
+    memblock_t*	base;
+
+    // if there is a free block behind the rover,
+    //  back up over them
+    base = mainzone->rover;
+    
+    if (base->prev->tag == PU_FREE)
+        base = base->prev;
+	
+    rover = base;
+    start = base->prev;
+	
+    do
+    {
+        scansteps++;
+
+        if (rover == start)
+        {
+            // scanned all the way around the list
+            return NULL;
+        }
+	
+        if (rover->tag != PU_FREE)
+        {
+            if (rover->tag < PU_PURGELEVEL)
+            {
+                // hit a block that can't be purged,
+                // so move base past it
+                base = rover = rover->next;
+            }
+            else
+            {
+                // free the rover block (adding the size to base)
+
+                // the rover can be the base block
+                base = base->prev;
+                Z_Purge (rover);
+                base = base->next;
+                rover = base->next;
+            }
+        }
+        else
+        {
+            rover = rover->next;
+        }
+
+    } while (base->tag != PU_FREE || base->size < size);
+
+    return base;
+}
+
 
 //
-// Z_ClearZone
+// Z_AddRegion
+// Returns a free block of at least size bytes,
+//  in a new region at the end of the zone.
 //
-void Z_ClearZone (memzone_t* zone)
+static memblock_t *Z_AddRegion (int size)
 {
-    memblock_t*		block;
-	
-    // set the entire zone to one free block
-    zone->blocklist.next =
-	zone->blocklist.prev =
-	block = (memblock_t *)( (byte *)zone + sizeof(memzone_t) );
-    
-    zone->blocklist.user = (void *)zone;
-    zone->blocklist.tag = PU_STATIC;
-    zone->rover = block;
-	
-    block->prev = block->next = &zone->blocklist;
-    
-    // a free block.
+    memblock_t*	start;
+    memblock_t*	block;
+    int		regionsize;
+
+    regionsize = sizeof(memblock_t) + size;
+
+    if (regionsize < ZONEREGION)
+        regionsize = ZONEREGION;
+
+    start = (memblock_t *) I_ZoneRegion (regionsize);
+    block = (memblock_t *) ((byte *)start + sizeof(memblock_t));
+
+    start->size = sizeof(memblock_t);
+    start->user = NULL;
+    start->tag = PU_STATIC;
+    start->id = REGIONID;
+
+    block->size = regionsize - sizeof(memblock_t);
+    block->user = NULL;
     block->tag = PU_FREE;
+    block->id = 0;
 
-    block->size = zone->size - sizeof(memzone_t);
-}
+    start->prev = mainzone->blocklist.prev;
+    start->next = block;
+    block->prev = start;
+    block->next = &mainzone->blocklist;
 
+    start->prev->next = start;
+    mainzone->blocklist.prev = block;
+
+    start->listnext = zoneregions;
+    zoneregions = start;
+
+    mainzone->size += regionsize;
+
+    return block;
+}
 
 
 //
-// Z_Init
+// Z_DiscardRegions
+// Gives back the pages of the added regions none of which is used.
 //
-void Z_Init (void)
+static void Z_DiscardRegions (void)
 {
+    memblock_t*	start;
     memblock_t*	block;
-    int		size;
 
-    mainzone = (memzone_t *)I_ZoneBase (&size);
-    mainzone->size = size;
+    for (start = zoneregions ; start ; start = start->listnext)
+    {
+        block = start->next;
 
-    // set the entire zone to one free block
-    mainzone->blocklist.next =
-	mainzone->blocklist.prev =
-	block = (memblock_t *)( (byte *)mainzone + sizeof(memzone_t) );
+        if (block->tag == PU_FREE
+         && (block->next == &mainzone->blocklist || Z_RegionStart (block->next)))
+        {
+            I_ZoneDiscard ((byte *)block + sizeof(memblock_t),
+                           block->size - sizeof(memblock_t));
+        }
+    }
+}
 
-    mainzone->blocklist.user = (void *)mainzone;
-    mainzone->blocklist.tag = PU_STATIC;
-    mainzone->rover = block;
-	
-    block->prev = block->next = &mainzone->blocklist;
 
-    // free block
-    block->tag = PU_FREE;
-    
-    block->size = mainzone->size - sizeof(memzone_t);
+//
+// Z_NewArenaChunk
+// Returns the room in a new chunk of the arena.
+//
+static byte *
+Z_NewArenaChunk
+( arena_t*	arena,
+  int		size,
+  char*		file,
+  int		line )
+{
+    void**	chunk;
+
+    chunk = Z_Malloc2 (sizeof(*chunk) + size, PU_STATIC, NULL, file, line);
+    *chunk = arena->chunks;
+    arena->chunks = chunk;
+
+    return (byte *) (chunk + 1);
 }
 
 
 //
-// Z_Free
+// Z_MallocArena
+// Size includes the header.
 //
-void Z_Free (void* ptr)
+static void *
+Z_MallocArena
+( int		size,
+  int		tag,
+  char*		file,
+  int		line )
 {
-    memblock_t*		block;
-    memblock_t*		other;
-	
-    block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
-
-    if (block->id != ZONEID)
-	I_Error ("Z_Free: freed a pointer without ZONEID");
-		
-    if (block->tag != PU_FREE && block->user != NULL)
-    {
-    	// clear the user's mark
-	    *block->user = 0;
-    }
+    arena_t*	arena;
+    memblock_t*	block;
+    int		bin;
 
-    // mark as free
-    block->tag = PU_FREE;
-    block->user = NULL;
-    block->id = 0;
-	
-    other = block->prev;
+    arena = &arenas[tag - PU_LEVEL];
+    bin = Z_SizeBin (size);
+    block = arena->freelists[bin];
 
-    if (other->tag == PU_FREE)
+    // reuse a block of about the size freed during the level
+    if (block && block->size >= size)
     {
-        // merge with previous free block
-        other->size += block->size;
-        other->next = block->next;
-        other->next->prev = other;
+	arena->freelists[bin] = block->next;
+	block->id = ARENAID;
 
-        if (block == mainzone->rover)
-            mainzone->rover = other;
+	return (byte *)block + sizeof(memblock_t);
+    }
 
-        block = other;
+    if (size > ARENACHUNK/4)
+    {
+	// large blocks get a chunk of their own, so
+	//  that the rest of the last one is not lost
+	block = (memblock_t *) Z_NewArenaChunk (arena, size, file, line);
     }
-	
-    other = block->next;
-    if (other->tag == PU_FREE)
+    else
     {
-        // merge the next free block onto the end
-        block->size += other->size;
-        block->next = other->next;
-        block->next->prev = block;
+	if (arena->end - arena->top < size)
+	{
+	    arena->top = Z_NewArenaChunk (arena, ARENACHUNK, file, line);
+	    arena->end = arena->top + ARENACHUNK;
+	}
 
-        if (other == mainzone->rover)
-            mainzone->rover = block;
+	block = (memblock_t *) arena->top;
+	arena->top += size;
     }
+
+    block->size = size;
+    block->user = NULL;
+    block->tag = tag;
+    block->id = ARENAID;
+    block->next = block->prev = NULL;
+
+    return (byte *)block + sizeof(memblock_t);
 }
 
 
+//
+// Z_ClearArena
+// Frees the chunks and strays of an arena.
+//
+static void Z_ClearArena (arena_t* arena)
+{
+    void*	chunk;
+
+    while (arena->chunks)
+    {
+	chunk = arena->chunks;
+	arena->chunks = *(void **) chunk;
+	Z_FreeBlock ((memblock_t *) ((byte *)chunk - sizeof(memblock_t)));
+    }
+
+    while (arena->strays.listnext != &arena->strays)
+	Z_FreeBlock (arena->strays.listnext);
+
+    arena->top = arena->end = NULL;
+    memset (arena->freelists, 0, sizeof(arena->freelists));
+}
+
 
 //
 // Z_Malloc
@@ -182,72 +1157,58 @@ void Z_Free (void* ptr)
 
 
 void*
-Z_Malloc
+Z_Malloc2
 ( int		size,
   int		tag,
-  void*		user )
+  void*		user,
+  char*		file,
+  int		line )
 {
     int		extra;
-    memblock_t*	start;
-    memblock_t* rover;
     memblock_t* newblock;
     memblock_t*	base;
     void *result;
 
+    if (zonesignal)
+        Z_Report ();
+
     size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
-    
-    // scan through the block list,
-    // looking for the first free block
-    // of sufficient size,
-    // throwing out any purgable blocks along the way.
 
     // account for size of block header
     size += sizeof(memblock_t);
-    
-    // if there is a free block behind the rover,
-    //  back up over them
-    base = mainzone->rover;
-    
-    if (base->prev->tag == PU_FREE)
-        base = base->prev;
-	
-    rover = base;
-    start = base->prev;
-	
-    do
+
+    if (zonearena && user == NULL && tag >= PU_LEVEL && tag <= PU_LEVSPEC)
     {
-        if (rover == start)
-        {
-            // scanned all the way around the list
-            I_Error ("Z_Malloc: failed on allocation of %i bytes", size);
-        }
-	
-        if (rover->tag != PU_FREE)
-        {
-            if (rover->tag < PU_PURGELEVEL)
-            {
-                // hit a block that can't be purged,
-                // so move base past it
-                base = rover = rover->next;
-            }
-            else
-            {
-                // free the rover block (adding the size to base)
+        result = Z_MallocArena (size, tag, file, line);
+        base = (memblock_t *) ((byte *)result - sizeof(memblock_t));
 
-                // the rover can be the base block
-                base = base->prev;
-                Z_Free ((byte *)rover+sizeof(memblock_t));
-                base = base->next;
-                rover = base->next;
-            }
-        }
-        else
-        {
-            rover = rover->next;
-        }
+        zonestats[tag].objects++;
 
-    } while (base->tag != PU_FREE || base->size < size);
+        if (tracefile)
+            Z_Trace (ZT_OBJECT, base, base->size, tag, file, line);
+
+        return result;
+    }
+
+    purgefile = file;
+    purgeline = line;
+    scansteps = 0;
+
+    if (zoneindex)
+        base = Z_FindIndexed (size);
+    else
+        base = Z_FindRover (size);
+
+    Z_CountScan ();
+
+    if (!base)
+    {
+        if (!zonegrow)
+            I_Error ("%s:%i: Z_Malloc: failed on allocation of %i bytes",
+                     file, line, size);
 
+        base = Z_AddRegion (size);
+    }
     
     // found a block big enough
     extra = base->size - size;
@@ -266,10 +1227,14 @@ Z_Malloc
 
         base->next = newblock;
         base->size = size;
+
+        if (zoneindex)
+            Z_LinkFree (newblock);
     }
 	
 	if (user == NULL && tag >= PU_PURGELEVEL)
-	    I_Error ("Z_Malloc: an owner is required for purgable blocks");
+	    I_Error ("%s:%i: Z_Malloc: an owner is required "
+	             "for purgable blocks", file, line);
 
     base->user = user;
     base->tag = tag;
@@ -281,16 +1246,94 @@ Z_Malloc
         *base->user = result;
     }
 
+    if (Z_TagList (tag))
+        Z_LinkList (Z_TagList (tag), base);
+
     // next allocation will start looking here
     mainzone->rover = base->next;	
 	
     base->id = ZONEID;
+
+    zonestats[tag].live += base->size;
+    zonestats[tag].blocks++;
+    zonestats[tag].mallocs++;
+
+    if (tracefile)
+        Z_Trace (ZT_MALLOC, base, base->size, tag, file, line);
     
     return result;
 }
 
 
 
+//
+// Z_MallocSlab
+// For level objects of a fixed size, see SLAB POOLS.
+// They can be freed with Z_Free, but have no user.
+//
+void*
+Z_MallocSlab2
+( int		size,
+  int		tag,
+  char*		file,
+  int		line )
+{
+    slabpool_t*	pool;
+    memblock_t*	block;
+    byte*	slab;
+    int		i;
+
+    if (tag >= PU_PURGELEVEL)
+	I_Error ("Z_MallocSlab: slabs can not be purged");
+
+    size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
+    size += sizeof(memblock_t);
+
+    pool = Z_FindSlabPool (size, tag);
+
+    if (!pool)
+    {
+	if (numslabpools == MAXSLABPOOLS)
+	    I_Error ("Z_MallocSlab: no more than %i pools", MAXSLABPOOLS);
+
+	pool = &slabpools[numslabpools++];
+	pool->size = size;
+	pool->tag = tag;
+	pool->freelist = NULL;
+    }
+
+    if (!pool->freelist)
+    {
+	// carve a new slab, in address order
+	slab = Z_Malloc2 (size * SLABOBJECTS, tag, NULL, file, line);
+
+	for (i=SLABOBJECTS-1 ; i>=0 ; i--)
+	{
+	    block = (memblock_t *) (slab + i*size);
+	    block->size = size;
+	    block->user = NULL;
+	    block->tag = tag;
+	    block->prev = NULL;
+	    block->next = pool->freelist;
+	    pool->freelist = block;
+	}
+    }
+
+    block = pool->freelist;
+    pool->freelist = block->next;
+
+    block->id = SLABID;
+
+    zonestats[tag].objects++;
+
+    if (tracefile)
+	Z_Trace (ZT_OBJECT, block, block->size, tag, file, line);
+
+    return (byte *)block + sizeof(memblock_t);
+}
+
+
+
 //
 // Z_FreeTags
 //
@@ -301,6 +1344,30 @@ Z_FreeTags
 {
     memblock_t*	block;
     memblock_t*	next;
+    memblock_t*	prev;
+    int		i;
+
+    if (tracefile)
+	Z_Trace (ZT_FREETAGS, NULL, lowtag, hightag, NULL, 0);
+
+    // the slabs go with the rest
+    for (i=0 ; i<numslabpools ; i++)
+	if (slabpools[i].tag >= lowtag && slabpools[i].tag <= hightag)
+	    slabpools[i].freelist = NULL;
+
+    if (zonearena)
+    {
+	for (i=0 ; i<NUMARENAS ; i++)
+	    if (PU_LEVEL + i >= lowtag && PU_LEVEL + i <= hightag)
+		Z_ClearArena (&arenas[i]);
+
+	// nothing else in the zone has these tags
+	if (lowtag >= PU_LEVEL && hightag <= PU_LEVSPEC)
+	{
+	    Z_DiscardRegions ();
+	    return;
+	}
+    }
 	
     for (block = mainzone->blocklist.next ;
 	 block != &mainzone->blocklist ;
@@ -314,8 +1381,17 @@ Z_FreeTags
 	    continue;
 	
 	if (block->tag >= lowtag && block->tag <= hightag)
-	    Z_Free ( (byte *)block+sizeof(memblock_t));
+	{
+	    // the next block may be merged into this one, and
+	    //  this one into a free block before it, so go on
+	    //  from the free block this ends up in
+	    prev = block->prev;
+	    Z_FreeBlock (block);
+	    next = (prev->tag == PU_FREE ? prev : block)->next;
+	}
     }
+
+    Z_DiscardRegions ();
 }
 
 
@@ -349,7 +1425,8 @@ Z_DumpHeap
 	    break;
 	}
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
+	if ( (byte *)block + block->size != (byte *)block->next
+	     && !Z_RegionStart (block->next))
 	    printf ("ERROR: block size does not touch the next block\n");
 
 	if ( block->next->prev != block)
@@ -381,7 +1458,8 @@ void Z_FileDumpHeap (FILE* f)
 	    break;
 	}
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
+	if ( (byte *)block + block->size != (byte *)block->next
+	     && !Z_RegionStart (block->next))
 	    fprintf (f,"ERROR: block size does not touch the next block\n");
 
 	if ( block->next->prev != block)
@@ -393,6 +1471,74 @@ void Z_FileDumpHeap (FILE* f)
 }
 
 
+//
+// Z_FileDumpStats
+// See STATISTICS.
+//
+void Z_FileDumpStats (FILE* f)
+{
+    static char*	tagnames[PU_NUM_TAGS] =
+    {
+        NULL, "static", "sound", "music", NULL,
+        "level", "levspec", "purgelevel", "cache"
+    };
+    memblock_t*	block;
+    zonestats_t*	stats;
+    int		freebytes;
+    int		freeblocks;
+    int		largest;
+    int		regions;
+    int		i;
+
+    freebytes = freeblocks = largest = 0;
+    regions = 1;
+
+    for (block = mainzone->blocklist.next ;
+	 block != &mainzone->blocklist ;
+	 block = block->next)
+    {
+	if (Z_RegionStart (block))
+	    regions++;
+
+	if (block->tag != PU_FREE)
+	    continue;
+
+	freebytes += block->size;
+	freeblocks++;
+
+	if (block->size > largest)
+	    largest = block->size;
+    }
+
+    fprintf (f, "zone size: %i in %i regions  free: %i in %i blocks\n",
+	     mainzone->size, regions, freebytes, freeblocks);
+
+    // how much of the free memory is not in the largest block
+    fprintf (f, "largest free block: %i  fragmentation: %.1f%%\n",
+	     largest, freebytes ? 100.0 * (freebytes - largest) / freebytes : 0.0);
+
+    fprintf (f, "scans: %" PRIu64 "  blocks looked at: %" PRIu64
+	     "  longest: %i\n", zonescans, zonesteps, longestscan);
+
+    fprintf (f, "%-10s %10s %7s %10s %10s %10s %10s %10s\n",
+	     "tag", "live", "blocks", "mallocs", "frees", "purges",
+	     "objects", "objfrees");
+
+    for (i=PU_STATIC ; i<PU_NUM_TAGS ; i++)
+    {
+	if (i == PU_FREE)
+	    continue;
+
+	stats = &zonestats[i];
+
+	fprintf (f, "%-10s %10i %7i %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+		 " %10" PRIu64 " %10" PRIu64 "\n",
+		 tagnames[i], stats->live, stats->blocks, stats->mallocs,
+		 stats->frees, stats->purges, stats->objects, stats->objfrees);
+    }
+}
+
+
 
 //
 // Z_CheckHeap
@@ -400,6 +1546,7 @@ void Z_FileDumpHeap (FILE* f)
 void Z_CheckHeap (void)
 {
     memblock_t*	block;
+    int		i;
 	
     for (block = mainzone->blocklist.next ; ; block = block->next)
     {
@@ -409,7 +1556,8 @@ void Z_CheckHeap (void)
 	    break;
 	}
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
+	if ( (byte *)block + block->size != (byte *)block->next
+	     && !Z_RegionStart (block->next))
 	    I_Error ("Z_CheckHeap: block size does not touch the next block\n");
 
 	if ( block->next->prev != block)
@@ -418,6 +1566,14 @@ void Z_CheckHeap (void)
 	if (block->tag == PU_FREE && block->next->tag == PU_FREE)
 	    I_Error ("Z_CheckHeap: two consecutive free blocks\n");
     }
+
+    if (zoneindex)
+    {
+	for (i=0 ; i<NUMBINS ; i++)
+	    for (block = freebins[i] ; block ; block = block->listnext)
+		if (block->tag != PU_FREE || Z_SizeBin (block->size) != i)
+		    I_Error ("Z_CheckHeap: bad block on a free list\n");
+    }
 }
 
 
@@ -430,8 +1586,19 @@ void Z_ChangeTag2(void *ptr, int tag, char *file, int line)
 {
     memblock_t*	block;
 	
+    if (zonesignal)
+        Z_Report ();
+
     block = (memblock_t *) ((byte *)ptr - sizeof(memblock_t));
 
+    if (block->id == ARENAID)
+    {
+        if (tag != block->tag)
+            I_Error("%s:%i: Z_ChangeTag: blocks in a level arena "
+                    "keep their tag", file, line);
+        return;
+    }
+
     if (block->id != ZONEID)
         I_Error("%s:%i: Z_ChangeTag: block without a ZONEID!",
                 file, line);
@@ -440,6 +1607,26 @@ void Z_ChangeTag2(void *ptr, int tag, char *file, int line)
         I_Error("%s:%i: Z_ChangeTag: an owner is required "
                 "for purgable blocks", file, line);
 
+    // purgable blocks age from when they are let go,
+    //  level blocks become strays of the arena
+    if (Z_TagList (block->tag) != Z_TagList (tag))
+    {
+        if (Z_TagList (block->tag))
+            Z_UnlinkList (block);
+        if (Z_TagList (tag))
+            Z_LinkList (Z_TagList (tag), block);
+    }
+
+    zonestats[block->tag].live -= block->size;
+    zonestats[block->tag].blocks--;
+    zonestats[tag].live += block->size;
+    zonestats[tag].blocks++;
+
+    // lumps are changed back to PU_STATIC each time they
+    //  are cached, which would fill up the trace
+    if (tracefile && tag != block->tag)
+        Z_Trace (ZT_CHANGETAG, block, block->size, tag, file, line);
+
     block->tag = tag;
 }
 
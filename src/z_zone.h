@@ -51,11 +51,13 @@ enum
         
 
 void	Z_Init (void);
-void*	Z_Malloc (int size, int tag, void *ptr);
-void    Z_Free (void *ptr);
+void*	Z_Malloc2 (int size, int tag, void *ptr, char *file, int line);
+void*	Z_MallocSlab2 (int size, int tag, char *file, int line);
+void    Z_Free2 (void *ptr, char *file, int line);
 void    Z_FreeTags (int lowtag, int hightag);
 void    Z_DumpHeap (int lowtag, int hightag);
 void    Z_FileDumpHeap (FILE *f);
+void    Z_FileDumpStats (FILE *f);
 void    Z_CheckHeap (void);
 void    Z_ChangeTag2 (void *ptr, int tag, char *file, int line);
 void    Z_ChangeUser(void *ptr, void **user);
@@ -66,6 +68,15 @@ unsigned int Z_ZoneSize(void);
 // This is used to get the local FILE:LINE info from CPP
 // prior to really call the function in question.
 //
+#define Z_Malloc(s,t,p)                                        \
+    Z_Malloc2((s), (t), (p), __FILE__, __LINE__)
+
+#define Z_MallocSlab(s,t)                                      \
+    Z_MallocSlab2((s), (t), __FILE__, __LINE__)
+
+#define Z_Free(p)                                              \
+    Z_Free2((p), __FILE__, __LINE__)
+
 #define Z_ChangeTag(p,t)                                       \
     Z_ChangeTag2((p), (t), __FILE__, __LINE__)
 